@@ -0,0 +1,524 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "../bitboard.h"
+#include "../position.h"
+#include "../movgen.h"
+#include "../search.h"
+#include "../eval.h"
+#include "../nnue.h"
+#include "../tt.h"
+
+
+
+// Micro-benchmarks of the hot paths of the engine (make bench-micro).
+//
+// Every benchmark runs an operation over all the positions of a fixed corpus,
+// again and again during a sample of SampleTime milliseconds, and reports the
+// mean time per operation over all the samples, its standard deviation and
+// the fastest sample, along with the CPU cycles and instructions per
+// operation when the hardware counters can be read (Linux perf events). This
+// tells which subsystem a change of the "bench" speed comes from:
+//
+//     ./microbench [samples] [ms per sample]
+
+
+
+// Default number of samples per benchmark, and length of a sample (ms)
+#define DefaultSamples     10
+#define DefaultSampleTime  50
+
+
+
+// Corpus of positions: the perft positions and a few middlegames/endgames
+static const char *Corpus[] =
+{
+    FenPosStartpos,
+    FenPosKiwipete,
+    FenPos3,
+    FenPos4,
+    FenPos5,
+    FenPos6,
+    "r1bq1rk1/2p1bppp/p1np1n2/4p3/Pp2P3/1BN2N2/1PPP1PPP/R1BQR1K1 w - - 0 1",
+    "5rk1/2b2ppp/pp3n2/2p1p1B1/4P3/2NP4/PPP2PPP/5RK1 w - - 0 1",
+    "r3k2r/5ppp/p3p3/1p1p4/1PpP4/2P1P3/P3KPPP/RR6 w kq - 0 1",
+    "2r3k1/1ppq1pp1/p1n2n1p/8/3P4/1PBQ1N1P/P4PP1/3R2K1 w - - 0 1",
+};
+
+
+
+// Checksum of the results of all the operations, printed at the end, so that
+// the compiler can't optimize them away
+static uint64_t sink = 0;
+
+
+
+// State of the keys probed and saved by the TT benchmarks
+static uint64_t ttKey = 1;
+
+
+
+// MicroBench_t is a benchmark: its name, whether it needs the network, and
+// the function running the operation on a position, which returns the number
+// of operations done
+typedef struct
+{
+    const char *name;
+    bool        nnue;
+    uint64_t  (*run)(Position_t &);
+} MicroBench_t;
+
+
+
+// benchGenerateMoves
+//
+// Generate all the legal moves.
+static uint64_t benchGenerateMoves(Position_t &pos)
+{
+    MoveList_t moves;
+
+    generateMoves(pos, moves);
+    sink += moves.count;
+
+    return 1;
+}
+
+
+
+// benchGenerateCaptures
+//
+// Generate the captures and promotions.
+static uint64_t benchGenerateCaptures(Position_t &pos)
+{
+    MoveList_t moves;
+
+    generateCapturesAndPromotions(pos, moves);
+    sink += moves.count;
+
+    return 1;
+}
+
+
+
+// benchMakeTakeBack
+//
+// Make and take back every legal move, as the search does.
+static uint64_t benchMakeTakeBack(Position_t &pos)
+{
+    MoveList_t moves;
+    generateMoves(pos, moves);
+
+    for (int i = 0; i < moves.count; i++)
+    {
+        pos.ply++;
+        makeMove(pos, moves.moves[i]);
+        sink += pos.hash_key;
+        takeBack(pos);
+        pos.ply--;
+    }
+
+    return moves.count;
+}
+
+
+
+// benchSee
+//
+// Static exchange evaluation of every capture.
+static uint64_t benchSee(Position_t &pos)
+{
+    MoveList_t moves;
+    generateCapturesAndPromotions(pos, moves);
+
+    for (int i = 0; i < moves.count; i++)
+        sink += see(pos, moves.moves[i]);
+
+    return moves.count;
+}
+
+
+
+// benchSquareAttacked
+//
+// Tell whether every square is attacked by either side.
+static uint64_t benchSquareAttacked(Position_t &pos)
+{
+    for (int sq = a8; sq <= h1; sq++)
+        sink += isSquareAttacked(pos, sq, White) + isSquareAttacked(pos, sq, Black);
+
+    return 128;
+}
+
+
+
+// benchEvaluate
+//
+// Evaluate the position, which is found in the evaluation cache after the
+// first time, as it happens to most positions revisited by the search.
+static uint64_t benchEvaluate(Position_t &pos)
+{
+    sink += evaluate(pos);
+
+    return 1;
+}
+
+
+
+// benchNNUEIncremental
+//
+// Evaluate the position after every legal move with the network, updating
+// the accumulator incrementally (bypassing the evaluation cache): this
+// includes makeMove() and takeBack(), see benchMakeTakeBack.
+static uint64_t benchNNUEIncremental(Position_t &pos)
+{
+    MoveList_t moves;
+    NNUEdata *nnue[3];
+
+    generateMoves(pos, moves);
+
+    for (int i = 0; i < moves.count; i++)
+    {
+        pos.ply++;
+        makeMove(pos, moves.moves[i]);
+
+        nnue[0] = &pos.nnue[pos.ply];
+        nnue[1] = &pos.nnue[pos.ply - 1];
+        nnue[2] = nullptr;
+        sink += nnue_evaluate_incremental(pos.sideToMove, pos.nnuePieces, pos.nnueSquares, nnue);
+
+        takeBack(pos);
+        pos.ply--;
+    }
+
+    return moves.count;
+}
+
+
+
+// benchNNUERefresh
+//
+// Evaluate the position with the network from scratch (accumulator refresh).
+static uint64_t benchNNUERefresh(Position_t &pos)
+{
+    sink += nnue_evaluate(pos.sideToMove, pos.nnuePieces, pos.nnueSquares);
+
+    return 1;
+}
+
+
+
+// nextKey
+//
+// Next key of the TT benchmarks (xorshift64), which spreads the entries over
+// the whole table, so that most accesses miss the CPU caches.
+static inline uint64_t nextKey()
+{
+    ttKey ^= ttKey << 13;
+    ttKey ^= ttKey >> 7;
+    ttKey ^= ttKey << 17;
+
+    return ttKey;
+}
+
+
+
+// benchTTSave
+//
+// Save 64 entries, with keys at random.
+static uint64_t benchTTSave(Position_t &pos)
+{
+    uint64_t key = pos.hash_key;
+
+    for (int i = 0; i < 64; i++)
+    {
+        pos.hash_key = nextKey();
+        TT::save(pos, i, 0, 1 + (i & 7), hash_type_exact, i);
+    }
+
+    pos.hash_key = key;
+
+    return 64;
+}
+
+
+
+// benchTTProbe
+//
+// Probe 64 entries, with keys at random (about half of them saved before by
+// benchTTSave, which used the same keys).
+static uint64_t benchTTProbe(Position_t &pos)
+{
+    uint64_t key = pos.hash_key;
+    int move, eval;
+
+    for (int i = 0; i < 64; i++)
+    {
+        pos.hash_key = nextKey();
+        sink += TT::probe(pos, -ValueInfinite, ValueInfinite, move, 1, eval);
+    }
+
+    pos.hash_key = key;
+
+    return 64;
+}
+
+
+
+// List of all the benchmarks
+static const MicroBench_t Benchmarks[] =
+{
+    { "generateMoves",                 false, benchGenerateMoves    },
+    { "generateCapturesAndPromotions", false, benchGenerateCaptures },
+    { "makeMove+takeBack",             false, benchMakeTakeBack     },
+    { "see",                           false, benchSee              },
+    { "isSquareAttacked",              false, benchSquareAttacked   },
+    { "evaluate (cache hit)",          true,  benchEvaluate         },
+    { "NNUE incremental (+make/take)", true,  benchNNUEIncremental  },
+    { "NNUE refresh",                  true,  benchNNUERefresh      },
+    { "TT::save",                      false, benchTTSave           },
+    { "TT::probe",                     false, benchTTProbe          },
+};
+
+
+
+// Hardware counters (CPU cycles and instructions) of the calling thread,
+// read as a group, or -1 if they are not available (e.g., not Linux, or
+// perf_event_paranoid forbids them)
+static int perfFd = -1;
+static int perfInstrFd = -1;
+
+
+
+// perfOpen
+//
+// Open the counters of CPU cycles and instructions, in user space only.
+static void perfOpen()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_GROUP;
+
+    perfFd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perfFd < 0)
+        return;
+
+    attr.config   = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 0;
+
+    perfInstrFd = syscall(SYS_perf_event_open, &attr, 0, -1, perfFd, 0);
+    if (perfInstrFd < 0)
+    {
+        close(perfFd);
+        perfFd = -1;
+    }
+#endif
+}
+
+
+
+// perfStart
+//
+// Reset and start the counters.
+static void perfStart()
+{
+#ifdef __linux__
+    if (perfFd < 0)
+        return;
+
+    ioctl(perfFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perfFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+
+
+// perfStop
+//
+// Stop the counters and read the cycles and instructions counted.
+static void perfStop(uint64_t &cycles, uint64_t &instructions)
+{
+    cycles = instructions = 0;
+
+#ifdef __linux__
+    if (perfFd < 0)
+        return;
+
+    // group read format: number of counters, then their values
+    uint64_t values[3] = { 0, 0, 0 };
+
+    ioctl(perfFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    if (read(perfFd, values, sizeof(values)) == (ssize_t)sizeof(values))
+    {
+        cycles       = values[1];
+        instructions = values[2];
+    }
+#endif
+}
+
+
+
+// runBenchmark
+//
+// Run the samples of a benchmark over the corpus and print its results.
+static void runBenchmark(const MicroBench_t &bench, vector<unique_ptr<Position_t>> &corpus,
+                         int samples, int sampleTime)
+{
+    vector<double> ns;
+    uint64_t totalOps = 0, totalCycles = 0, totalInstructions = 0;
+
+
+    // warm up the caches (and the evaluation cache) with a first round
+    for (auto &pos : corpus)
+        bench.run(*pos);
+
+
+    // take the samples
+    for (int s = 0; s < samples; s++)
+    {
+        uint64_t ops = 0, cycles, instructions;
+
+        perfStart();
+        auto start = chrono::steady_clock::now();
+        auto limit = start + chrono::milliseconds(sampleTime);
+        auto now   = start;
+
+        do
+        {
+            for (auto &pos : corpus)
+                ops += bench.run(*pos);
+
+            now = chrono::steady_clock::now();
+        } while (now < limit);
+
+        perfStop(cycles, instructions);
+
+        ns.push_back(chrono::duration<double, nano>(now - start).count() / ops);
+        totalOps          += ops;
+        totalCycles       += cycles;
+        totalInstructions += instructions;
+    }
+
+
+    // mean, relative standard deviation and best sample
+    double mean = 0.0, var = 0.0;
+
+    for (double x : ns)
+        mean += x;
+    mean /= ns.size();
+
+    for (double x : ns)
+        var += (x - mean) * (x - mean);
+    var /= ns.size();
+
+    cout << left << setw(32) << bench.name << right << fixed
+         << setprecision(1) << setw(10) << mean
+         << setw(7) << 100.0 * sqrt(var) / mean << "%"
+         << setw(10) << *min_element(ns.begin(), ns.end());
+
+    if (totalCycles)
+        cout << setw(11) << (double)totalCycles / totalOps
+             << setw(11) << (double)totalInstructions / totalOps
+             << setprecision(2) << setw(7) << (double)totalInstructions / totalCycles;
+    else
+        cout << setw(11) << "n/a" << setw(11) << "n/a" << setw(7) << "n/a";
+
+    cout << endl << flush;
+}
+
+
+
+// main
+//
+// Initialize the engine as main() does, set up the corpus and run all the
+// benchmarks. Those evaluating the network are skipped if it can't be loaded
+// (EvalFileDefault, from the current directory).
+int main(int argc, char *argv[])
+{
+    int samples    = (argc > 1) ? max(atoi(argv[1]), 1) : DefaultSamples;
+    int sampleTime = (argc > 2) ? max(atoi(argv[2]), 1) : DefaultSampleTime;
+
+
+    // initializations
+    initBitboards();
+    initRandomKeys();
+    initSearch();
+    TT::init(16);
+
+    bool nnue = nnue_init(EvalFileDefault);
+    if (!nnue)
+        cout << "Cannot load the neural network " << EvalFileDefault
+             << ": the NNUE benchmarks are skipped" << endl;
+
+    perfOpen();
+
+
+    // positions of the corpus (Position_t is too large for the stack)
+    vector<unique_ptr<Position_t>> corpus;
+
+    for (const char *fen : Corpus)
+    {
+        corpus.emplace_back(new Position_t);
+        setPosition(*corpus.back(), fen);
+    }
+
+
+    // run the benchmarks
+    cout << endl << samples << " samples of " << sampleTime << " ms over "
+         << corpus.size() << " positions" << endl << endl;
+
+    cout << left << setw(32) << "Benchmark" << right << setw(10) << "ns/op" << setw(8) << "stddev"
+         << setw(10) << "min" << setw(11) << "cycles/op" << setw(11) << "instr/op"
+         << setw(7) << "IPC" << endl;
+
+    for (const MicroBench_t &bench : Benchmarks)
+        if (nnue || !bench.nnue)
+            runBenchmark(bench, corpus, samples, sampleTime);
+
+    cout << endl << "checksum " << sink << endl;
+
+
+    return 0;
+}
@@ -47,16 +47,24 @@ Bitboard KingAttacks[64];
 
 
 
-// Slider masks and attack tables
-Bitboard BishopMasks[64];
-Bitboard RookMasks[64];
-Bitboard BishopAttacks[64][512];
-Bitboard RookAttacks[64][4096];
+// Slider lookup data and attack tables (Bishops first, then Rooks)
+Magic_t BishopMagics[64];
+Magic_t RookMagics[64];
+alignas(64) Bitboard SliderAttacks[BishopTableSize + RookTableSize];
 
 
 
-// Pseudo-random number generator seed
+// Squares between two squares [square][square] (both excluded), and full
+// lines crossing two squares [square][square] (both included), only defined
+// for squares on the same rank, file or diagonal (otherwise, empty)
+Bitboard BetweenBB[64][64];
+Bitboard LineBB[64][64];
+
+
+
+// Pseudo-random number generator seeds
 uint32_t rng32_state = 1804289383;
+uint64_t rng64_state = 0x9E3779B97F4A7C15ULL;
 
 
 
@@ -528,20 +536,24 @@ void initLeaperAttacks()
 // Initialize the slider pieces' attacks.
 void initSliderAttacks(Slider isBishop)
 {
+    // the Bishop attacks go first in the table, then the Rook attacks
+    Bitboard *attacks = isBishop ? SliderAttacks : SliderAttacks + BishopTableSize;
+
+
     // loop over the 64 board squares
     for (int square = 0; square < 64; square++)
     {
-        // init Bishop & Rook masks
-        BishopMasks[square] = maskBishopAttacks(square);
-        RookMasks[square] = maskRookAttacks(square);
+        // init the lookup data of the current square
+        Magic_t &m = isBishop ? BishopMagics[square] : RookMagics[square];
 
-        
-        // init current mask
-        Bitboard AttackMask = isBishop ? BishopMasks[square] : RookMasks[square];
+        m.mask    = isBishop ? maskBishopAttacks(square) : maskRookAttacks(square);
+        m.magic   = isBishop ? BishopMagicNumbers[square] : RookMagicNumbers[square];
+        m.shift   = 64 - (isBishop ? BishopRelevantBits[square] : RookRelevantBits[square]);
+        m.attacks = attacks;
 
         
         // init relevant occupancy bit count
-        int RelevantBitsCount = countBits(AttackMask);
+        int RelevantBitsCount = countBits(m.mask);
 
         
         // init occupancy indices
@@ -551,34 +563,23 @@ void initSliderAttacks(Slider isBishop)
         // loop over occupancy indices
         for (int index = 0; index < OccupancyIndices; index++)
         {
-            // Bishop
-            if (isBishop)
-            {
-                // init current occupancy variation
-                Bitboard occupancy = setOccupancy(index, RelevantBitsCount, AttackMask);
-                
-                // init magic index
-                int MagicIndex = (occupancy * BishopMagicNumbers[square]) >> (64 - BishopRelevantBits[square]);
-                
-                // init bishop attacks
-                BishopAttacks[square][MagicIndex] = genBishopAttacks(square, occupancy);
-            }
+            // init current occupancy variation
+            Bitboard occupancy = setOccupancy(index, RelevantBitsCount, m.mask);
 
-            
-            // Rook
-            else
-            {
-                // init current occupancy variation
-                Bitboard occupancy = setOccupancy(index, RelevantBitsCount, AttackMask);
-                
-                // init magic index
-                int MagicIndex = (occupancy * RookMagicNumbers[square]) >> (64 - RookRelevantBits[square]);
-                
-                // init rook attacks
-                RookAttacks[square][MagicIndex] = genRookAttacks(square, occupancy);
-            }
+
+            // init the attacks under the magic (or PEXT) index
+            m.attacks[magicIndex(m, occupancy)] = isBishop ? genBishopAttacks(square, occupancy)
+                                                           : genRookAttacks(square, occupancy);
         }
+
+
+        // the attacks of the next square start right after this one's
+        attacks += OccupancyIndices;
     }
+
+
+    // the table sizes must match the relevant bits of all the squares
+    assert(attacks == SliderAttacks + BishopTableSize + (isBishop ? 0 : RookTableSize));
 }
 
 
@@ -624,6 +625,43 @@ void printBitboard(Bitboard bb)
 
 
 
+// initLineBitboards
+//
+// Initialize the lines and segments between two aligned squares, used to
+// find pinned pieces and to block checks.
+void initLineBitboards()
+{
+    for (int s1 = 0; s1 < 64; s1++)
+    {
+        for (int s2 = 0; s2 < 64; s2++)
+        {
+            BetweenBB[s1][s2] = 0ULL;
+            LineBB[s1][s2]    = 0ULL;
+
+            if (s1 == s2)
+                continue;
+
+
+            // same rank or file
+            if (getRookAttacks(s1, 0ULL) & SqBB[s2])
+            {
+                BetweenBB[s1][s2] = getRookAttacks(s1, SqBB[s2]) & getRookAttacks(s2, SqBB[s1]);
+                LineBB[s1][s2]    = (getRookAttacks(s1, 0ULL) & getRookAttacks(s2, 0ULL)) | SqBB[s1] | SqBB[s2];
+            }
+
+
+            // same diagonal
+            else if (getBishopAttacks(s1, 0ULL) & SqBB[s2])
+            {
+                BetweenBB[s1][s2] = getBishopAttacks(s1, SqBB[s2]) & getBishopAttacks(s2, SqBB[s1]);
+                LineBB[s1][s2]    = (getBishopAttacks(s1, 0ULL) & getBishopAttacks(s2, 0ULL)) | SqBB[s1] | SqBB[s2];
+            }
+        }
+    }
+}
+
+
+
 // initBitboards
 //
 // Call all different functions that initialize fundamental data structures
@@ -634,4 +672,5 @@ void initBitboards()
     initLeaperAttacks();
     initSliderAttacks(Bishop);
     initSliderAttacks(Rook);
+    initLineBitboards();
 }
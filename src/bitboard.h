@@ -25,6 +25,10 @@
 #include <array>
 #include <cassert>
 
+#if defined(USE_BMI2)
+    #include <immintrin.h>
+#endif
+
 
 
 // Bitboard data type = unsigned long long (64-bit number)
@@ -42,8 +46,8 @@ enum Slider { Rook, Bishop };
 
 
 
-// Piece constants: P=0, ..., k=11
-enum Pieces { P, N, B, R, Q, K, p, n, b, r, q, k };
+// Piece constants: P=0, ..., k=11, NoPiece=12 (empty square)
+enum Pieces { P, N, B, R, Q, K, p, n, b, r, q, k, NoPiece };
 
 
 
@@ -134,16 +138,42 @@ extern Bitboard KingAttacks[64];
 
 
 
-// Slider masks and attack tables
-extern Bitboard BishopMasks[64];
-extern Bitboard RookMasks[64];
-extern Bitboard BishopAttacks[64][512];
-extern Bitboard RookAttacks[64][4096];
+// Magic_t holds what is needed to look up the attacks of a slider on a
+// given square: the relevant occupancy mask, the magic number and its shift
+// (unused with PEXT), and where the attacks of the square start within the
+// SliderAttacks[] table.
+typedef struct
+{
+    Bitboard  mask;
+    Bitboard  magic;
+    Bitboard *attacks;
+    int       shift;
+} Magic_t;
+
+
+
+// Slider attack tables: the Bishop attacks of all the squares go first and
+// then the Rook attacks, packed into a single array (each square only takes
+// 2^RelevantBits entries), which is about one third of the size of the
+// [64][512] and [64][4096] tables and hence it's friendlier to the caches
+#define BishopTableSize   5248
+#define RookTableSize   102400
+
+extern Magic_t BishopMagics[64];
+extern Magic_t RookMagics[64];
+extern Bitboard SliderAttacks[BishopTableSize + RookTableSize];
+
+
+
+// Squares between two aligned squares and lines crossing them
+extern Bitboard BetweenBB[64][64];
+extern Bitboard LineBB[64][64];
 
 
 
-// Pseudo-random number generator seed
+// Pseudo-random number generator seeds
 extern uint32_t rng32_state;
+extern uint64_t rng64_state;
 
 
 
@@ -332,6 +362,7 @@ Bitboard setOccupancy(int, int, Bitboard);
 void initBitmaps();
 void initLeaperAttacks();
 void initSliderAttacks(Slider);
+void initLineBitboards();
 void initBitboards();
 
 
@@ -524,19 +555,35 @@ constexpr int popLsb(Bitboard& b)
 
 
 
+// magicIndex
+//
+// Return the index of the attacks for the given occupancy within the slider
+// attacks of a square. On CPUs with a fast BMI2 (Intel since Haswell, AMD
+// since Zen 3), PEXT extracts the relevant occupancy bits directly, otherwise
+// the index is computed with magic bitboards.
+static inline unsigned magicIndex(const Magic_t &m, Bitboard occupancy)
+{
+    #if defined(USE_BMI2)
+
+        return (unsigned)_pext_u64(occupancy, m.mask);
+
+    #else
+
+        return (unsigned)(((occupancy & m.mask) * m.magic) >> m.shift);
+
+    #endif
+}
+
+
+
 // getBishopAttacks
 //
 // Generate a Bitboard with the pseudo-legal Bishop attacks.
 static inline Bitboard getBishopAttacks(int square, Bitboard occupancy)
 {
-    // get bishop attacks assuming current board occupancy
-    occupancy &= BishopMasks[square];
-    occupancy *= BishopMagicNumbers[square];
-    occupancy >>= 64 - BishopRelevantBits[square];
-   
+    const Magic_t &m = BishopMagics[square];
 
-    // return bishop attacks
-    return BishopAttacks[square][occupancy];
+    return m.attacks[magicIndex(m, occupancy)];
 }
 
 
@@ -546,14 +593,9 @@ static inline Bitboard getBishopAttacks(int square, Bitboard occupancy)
 // Generate a Bitboard with the pseudo-legal Rook attacks.
 static inline Bitboard getRookAttacks(int square, Bitboard occupancy)
 {
-    // get rook attacks assuming current board occupancy
-    occupancy &= RookMasks[square];
-    occupancy *= RookMagicNumbers[square];
-    occupancy >>= 64 - RookRelevantBits[square];
-   
+    const Magic_t &m = RookMagics[square];
 
-    // return rook attacks
-    return RookAttacks[square][occupancy];
+    return m.attacks[magicIndex(m, occupancy)];
 }
 
 
@@ -563,31 +605,7 @@ static inline Bitboard getRookAttacks(int square, Bitboard occupancy)
 // Generate a Bitboard with the pseudo-legal Queen attacks.
 static inline Bitboard getQueenAttacks(int square, Bitboard occupancy)
 {
-    // init Queen attacks Bitboard
-    Bitboard QueenAttacks = 0ULL;
-   
-
-    // init Bishop and Rook occupancies
-    Bitboard BishopOccupancy = occupancy;
-    Bitboard RookOccupancy = occupancy;
-
-    
-    // get Bishop and Rook attacks assuming current board occupancy
-    BishopOccupancy &= BishopMasks[square];
-    BishopOccupancy *= BishopMagicNumbers[square];
-    BishopOccupancy >>= 64 - BishopRelevantBits[square];
-
-    QueenAttacks = BishopAttacks[square][BishopOccupancy];
-    
-    RookOccupancy &= RookMasks[square];
-    RookOccupancy *= RookMagicNumbers[square];
-    RookOccupancy >>= 64 - RookRelevantBits[square];
-    
-    QueenAttacks |= RookAttacks[square][RookOccupancy];
-
-    
-    // return Queen attacks
-    return QueenAttacks;
+    return getBishopAttacks(square, occupancy) | getRookAttacks(square, occupancy);
 }
 
 
@@ -597,6 +615,11 @@ static inline Bitboard getQueenAttacks(int square, Bitboard occupancy)
 // The functions rng32() and rng64() are a portable implementation of the 
 // XORSHIFT algorithm to generate a sequence of pseudo-random numbers that
 // is always the same for the same starting seed (state).
+//
+// rng64() has its own 64-bit state and scrambles its output with a multiply
+// (XORSHIFT64*): a plain XORSHIFT is linear, so the numbers it generates
+// from a 32-bit state only span 32 bits, which makes hash keys built with
+// them collide.
 
 // rng32
 //
@@ -628,19 +651,22 @@ static inline uint32_t rng32()
 // Generate a 64-bit pseudo-random number.
 static inline uint64_t rng64()
 {
-    // define 4 random numbers
-    uint64_t n1, n2, n3, n4;
-   
+    // get current state
+    uint64_t number = rng64_state;
 
-    // init random numbers slicing 16 bits from MS1B side
-    n1 = (uint64_t)(rng32() & 0xFFFF);
-    n2 = (uint64_t)(rng32() & 0xFFFF);
-    n3 = (uint64_t)(rng32() & 0xFFFF);
-    n4 = (uint64_t)(rng32() & 0xFFFF);
-   
 
-    // return random number
-    return (uint64_t) (n1 | (n2 << 16) | (n3 << 32) | (n4 << 48));
+    // XOR shift algorithm
+    number ^= number >> 12;
+    number ^= number << 25;
+    number ^= number >> 27;
+
+
+    // update random number state
+    rng64_state = number;
+
+
+    // return scrambled random number
+    return number * 0x2545F4914F6CDD1DULL;
 }
 
 
@@ -0,0 +1,227 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <chrono>
+
+#include "bitboard.h"
+#include "position.h"
+#include "movgen.h"
+#include "tt.h"
+#include "book.h"
+#include "nnue_misc.h"
+
+
+
+using namespace std;
+
+
+
+// Book file currently mapped (if any), and its number of entries
+static const void    *bookData = nullptr;
+static map_t          bookMap;
+static const uint8_t *bookEntries = nullptr;
+static size_t         bookSize = 0;
+
+
+
+// State of the pseudo-random generator choosing among the book moves, so
+// that the same game doesn't always follow the same line
+static uint64_t bookRng = 0;
+
+
+
+// readBigEndian
+//
+// Read a big-endian field of the given number of bytes.
+static inline uint64_t readBigEndian(const uint8_t *p, int bytes)
+{
+    uint64_t value = 0;
+
+    for (int i = 0; i < bytes; i++)
+        value = (value << 8) | p[i];
+
+    return value;
+}
+
+
+
+// readEntry
+//
+// Read the i-th entry of the book.
+static inline BookEntry_t readEntry(size_t i)
+{
+    const uint8_t *p = bookEntries + i * sizeof(BookEntry_t);
+
+    return { readBigEndian(p, 8), (uint16_t)readBigEndian(p + 8, 2),
+             (uint16_t)readBigEndian(p + 10, 2), (uint32_t)readBigEndian(p + 12, 4) };
+}
+
+
+
+// Book::init
+//
+// Map the given Polyglot book, replacing the current book. An empty file name
+// (or "<empty>") disables the book.
+void Book::init(const string &file)
+{
+    // free the book loaded so far
+    Book::free();
+
+
+    // no book configured
+    if (file.empty() || (file == "<empty>"))
+        return;
+
+
+    // map the file, which must hold whole entries
+    FD fd = open_file(file.c_str());
+    if (fd == FD_ERR)
+    {
+        cout << "info string Cannot open the book " << file << endl << flush;
+        return;
+    }
+
+    size_t size = file_size(fd);
+    const void *data = (size >= sizeof(BookEntry_t)) ? map_file(fd, &bookMap) : nullptr;
+    close_file(fd);
+
+    if (!data || (size % sizeof(BookEntry_t)))
+    {
+        unmap_file(data, bookMap);
+        cout << "info string Invalid book " << file << endl << flush;
+        return;
+    }
+
+    bookData    = data;
+    bookEntries = (const uint8_t *)data;
+    bookSize    = size / sizeof(BookEntry_t);
+    bookRng     = (chrono::steady_clock::now().time_since_epoch().count() * 0x9e3779b97f4a7c15ULL) | 1;
+
+    cout << "info string Book loaded: " << bookSize << " moves" << endl << flush;
+}
+
+
+
+// Book::free
+//
+// Unmap the book, if any.
+void Book::free()
+{
+    unmap_file(bookData, bookMap);
+
+    bookData    = nullptr;
+    bookEntries = nullptr;
+    bookSize    = 0;
+}
+
+
+
+// decodeBookMove
+//
+// Return the legal move matching a Polyglot move, or 0 if there is none.
+// Polyglot numbers the ranks from the first one and encodes castling as the
+// King capturing its own Rook (e.g., e1h1 for White O-O).
+static int decodeBookMove(Position_t &pos, uint16_t move)
+{
+    int toSq   = ((7 - ((move >> 3) & 7)) << 3) | (move & 7);
+    int fromSq = ((7 - ((move >> 9) & 7)) << 3) | ((move >> 6) & 7);
+    int promo  = (move >> 12) & 7;
+
+
+    // castling, as the King moving two squares
+    int piece = pos.board[fromSq];
+
+    if (((piece == K) && (fromSq == e1) && ((toSq == h1) || (toSq == a1)))
+        || ((piece == k) && (fromSq == e8) && ((toSq == h8) || (toSq == a8))))
+    {
+        toSq = (toSq > fromSq) ? fromSq + 2 : fromSq - 2;
+    }
+
+
+    // look for the move among the legal moves
+    MoveList_t moves;
+    generateMoves(pos, moves);
+
+    for (int i = 0; i < moves.count; i++)
+    {
+        int m = moves.moves[i];
+
+        if ((getMoveSource(m) == fromSq) && (getMoveTarget(m) == toSq)
+            && ((getPromo(m) ? (getPromo(m) % 6) : 0) == promo))
+        {
+            return m;
+        }
+    }
+
+    return 0;
+}
+
+
+
+// Book::probe
+//
+// Return a move of the book for the given position (0 if none), chosen at
+// random among the moves found, in proportion to their weights.
+int Book::probe(Position_t &pos)
+{
+    if (!bookSize)
+        return 0;
+
+
+    // binary search of the first entry of the position
+    uint64_t key = polyglotKey(pos);
+    size_t first = 0, last = bookSize;
+
+    while (first < last)
+    {
+        size_t mid = first + (last - first) / 2;
+
+        if (readEntry(mid).key < key)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+
+    // total weight of the moves of the position
+    unsigned total = 0;
+
+    for (size_t i = first; (i < bookSize) && (readEntry(i).key == key); i++)
+        total += readEntry(i).weight;
+
+    if (!total)
+        return 0;
+
+
+    // pick one of the moves of the position (xorshift64)
+    bookRng ^= bookRng << 13;
+    bookRng ^= bookRng >> 7;
+    bookRng ^= bookRng << 17;
+
+    unsigned pick = (bookRng >> 32) % total;
+
+    while (pick >= readEntry(first).weight)
+        pick -= readEntry(first++).weight;
+
+
+    // the move must be legal (e.g., in case of a collision of the keys)
+    return decodeBookMove(pos, readEntry(first).move);
+}
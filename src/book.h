@@ -0,0 +1,64 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <string>
+
+#include "bitboard.h"
+#include "position.h"
+
+
+
+// A Polyglot book is a sequence of BookEntry_t sorted by key, all the fields
+// being big-endian: the Polyglot key of the position (see polyglotKey()), the
+// move, its weight (how often the move is played among the moves of the
+// same position) and a learning field, which is not used.
+//
+// The move is encoded in 16 bits: target file and rank, source file and rank
+// (3 bits each, rank 0 being the first rank) and promoted piece (1=Knight,
+// ..., 4=Queen). Castling is encoded as the King capturing its own Rook.
+//
+// @see http://hgm.nubati.net/book_format.html
+typedef struct
+{
+    uint64_t key;
+    uint16_t move;
+    uint16_t weight;
+    uint32_t learn;
+} BookEntry_t;
+
+
+
+// Polyglot opening book, memory-mapped (read-only) and probed with a binary
+// search, so that a book move is played without searching at all.
+namespace Book
+{
+
+void init(const std::string &);
+void free();
+int  probe(Position_t &);
+
+}  //  namespace Book
+
+
+
+#endif  //  BOOK_H
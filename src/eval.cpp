@@ -18,12 +18,37 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
+
 #include "eval.h"
 #include "position.h"
 #include "nnue.h"
 
 
 
+using namespace std;
+
+
+
+// Evaluation cache of each search thread (see EvalCacheSize). The caches are
+// invalidated by bumping evalCacheGeneration (e.g., when a new network is
+// loaded), and each thread clears its own cache the next time it evaluates.
+static thread_local EvalCacheEntry_t evalCache[EvalCacheSize];
+static thread_local unsigned evalCacheThreadGeneration = ~0u;
+static atomic<unsigned> evalCacheGeneration(0);
+
+
+
+// clearEvalCache
+//
+// Invalidate the evaluation caches of all the threads.
+void clearEvalCache()
+{
+    evalCacheGeneration++;
+}
+
+
+
 // evaluate
 //
 // This evaluation function gives an absolute value with the current position
@@ -35,15 +60,34 @@
 // Note: this evaluation function solely relies on a neural network (NNUE file)
 // that has been trained with hundreds of millions of positions at moderate
 // depth using Stockfish.
-int evaluate()
-{    
-    // This function ends up calling the nnue_evaluate() function:
+int evaluate(Position_t &pos)
+{
+    // We need to make sure that fifty rule move counter gives a penalty
+    // to the evaluation, otherwise it won't be capable of mating in
+    // simple endgames like KQK or KRK! This expression is used:
+    //                    nnue_score * (100 - fifty) / 100
+
+    return scaleEval(pos, evaluateNNUE(pos, EvalNone));
+}
+
+
+
+// evaluateNNUE
+//
+// Return the raw NNUE score of the position (i.e., before scaling it with the
+// fifty move rule counter, see scaleEval()). If the score is known already
+// (e.g., from the TT), it's given as 'value'; otherwise it's looked up in the
+// evaluation cache, and the network is only evaluated on a miss.
+int evaluateNNUE(Position_t &pos, int value)
+{
+    // This function ends up calling the nnue_evaluate_incremental() function:
     //
-    // nnue_evaluate() takes three arguments:
+    // nnue_evaluate_incremental() takes four arguments:
     //
     // 1. (int)   side to move -- white=0, black=1
     // 2. (int *) array of pieces
     // 3. (int *)  array of squares each piece stands on
+    // 4. (NNUEdata **) accumulators for the current ply, ply-1 and ply-2
     //
     //
     // Piece codes are:
@@ -64,78 +108,49 @@ int evaluate()
     // Returns the score relative to side to move in approximate centi-pawns.
 
 
-    // current pieces bitboard copy
-    Bitboard bb;
+    // the position keeps its pieces in the format above, so they can be
+    // fed to the NNUE as they are (see putPiece() and removePiece())
 
 
-    // init piece & square
-    int piece, square;
+    // accumulators of the current position and the two previous plies: the
+    // NNUE updates the current one from the last accumulator computed, and
+    // only refreshes it from scratch (e.g., after a King move) when needed
+    NNUEdata *nnue[3];
+    nnue[0] = &pos.nnue[pos.ply];
+    nnue[1] = (pos.ply > 0) ? &pos.nnue[pos.ply - 1] : nullptr;
+    nnue[2] = (pos.ply > 1) ? &pos.nnue[pos.ply - 2] : nullptr;
 
 
-    // array of piece codes converted to Stockfish piece codes
-    int pieces[33];
-   
+    // clear the cache of this thread if it has been invalidated
+    if (evalCacheThreadGeneration != evalCacheGeneration)
+    {
+        for (EvalCacheEntry_t &e : evalCache)
+            e = { 0, EvalNone };
 
-    // array of square indices converted to Stockfish square indices
-    int squares[33];
-   
+        evalCacheThreadGeneration = evalCacheGeneration;
+    }
 
-    // pieces and squares current index to write next piece square pair at
-    int index = 2;
 
+    // look up the evaluation cache, the upper half of the hash key tells
+    // the position stored in the entry
+    EvalCacheEntry_t &entry = evalCache[pos.hash_key & (EvalCacheSize - 1)];
+    uint32_t key32 = pos.hash_key >> 32;
 
-    // loop over piece bitboards
-    for (int bb_piece = P; bb_piece <= k; bb_piece++)
+    if ((value == EvalNone) && (entry.key32 == key32))
+        value = entry.value;
+
+
+    // when the score is known, the accumulator is still updated, so that
+    // the next plies can update theirs incrementally from this one
+    if (value != EvalNone)
     {
-        // init piece bitboard copy
-        bb = bitboards[bb_piece];
-        
-        // loop over pieces within a bitboard
-        while (bb)
-        {
-            // init piece
-            piece = bb_piece;
-            
-            // init square
-            square = popLsb(bb);
-           
-
-            // initialize pieces and squares arrays for NNUE:
-
-            // white king
-            if (piece == K)
-            {
-                pieces[0] = nnue_pieces[piece];
-                squares[0] = nnue_squares[square];
-            }
-            
-            // black king
-            else if (piece == k)
-            {
-                pieces[1] = nnue_pieces[piece];
-                squares[1] = nnue_squares[square];
-            }
-            
-            // rest of the pieces
-            else
-            {
-                pieces[index] = nnue_pieces[piece];
-                squares[index] = nnue_squares[square];
-                index++;    
-            }
-        }
+        nnue_update_accumulator(pos.nnuePieces, pos.nnueSquares, nnue);
+        return value;
     }
-   
 
-    // set zero terminating characters at the end of pieces & squares arrays
-    pieces[index] = 0;
-    squares[index] = 0;
 
+    value = nnue_evaluate_incremental(pos.sideToMove, pos.nnuePieces, pos.nnueSquares, nnue);
+    entry = { key32, value };
 
-    // We need to make sure that fifty rule move counter gives a penalty
-    // to the evaluation, otherwise it won't be capable of mating in
-    // simple endgames like KQK or KRK! This expression is used:
-    //                    nnue_score * (100 - fifty) / 100
-
-    return (nnue_evaluate(sideToMove, pieces, squares) * (100 - fifty) / 100);
+    return value;
 }
@@ -22,10 +22,18 @@
 #define EVAL_H
 
 #include "bitboard.h"
+#include "position.h"
 #include "nnue.h"
 
 
 
+// Network loaded at startup (EvalFile option). Builds with an embedded
+// network (make EMBED=yes) don't need this file, as long as the network given
+// to the Makefile (EVALFILE) has the same name.
+#define EvalFileDefault "nn-eba324f53044.nnue"
+
+
+
 // Table to translate Gargantua piece codes to Stockfish piece codes.
 //
 // This table is needed in order to "feed" the neural network the pieces
@@ -52,8 +60,73 @@ static constexpr int nnue_squares[64] =
 
 
 
+// Value used when the static evaluation of a position is not known (e.g.,
+// it's not stored in its TT entry)
+#define EvalNone 100000
+
+
+
+// Per-thread evaluation cache: it's a direct-mapped table of the raw NNUE
+// scores, indexed by the lower bits of the hash key of the position, which
+// makes repeated evaluations (transpositions, re-searches) a single lookup.
+// The size must be a power of 2 (8 bytes per entry).
+#define EvalCacheSize 16384
+
+typedef struct {
+    uint32_t key32;
+    int32_t  value;
+} EvalCacheEntry_t;
+
+
+
 // evaluate() returns an absolute score from the NNUE evaluation.
-int evaluate();
+int evaluate(Position_t &);
+int evaluateNNUE(Position_t &, int);
+void clearEvalCache();
+
+
+
+// scaleEval
+//
+// Turn a raw NNUE score into the score returned by evaluate(). The raw score
+// only depends on the pieces, so it can be cached by hash key, but the
+// fifty move rule counter scales it down towards a draw.
+static inline int scaleEval(Position_t &pos, int value)
+{
+    return value * (100 - pos.fifty) / 100;
+}
+
+
+
+// addDirtyPiece
+//
+// Record a piece changed by a move (moved, captured or promoted) in the
+// given DirtyPiece, translating it into NNUE codes. Pieces placed on or
+// removed from the board use NoSq as source or target square respectively.
+static inline void addDirtyPiece(DirtyPiece *dp, int piece, int fromSq, int toSq)
+{
+    // reliability checks
+    assert(dp->dirtyNum < 3);
+
+
+    dp->pc[dp->dirtyNum]   = nnue_pieces[piece];
+    dp->from[dp->dirtyNum] = (fromSq == NoSq) ? 64 : nnue_squares[fromSq];
+    dp->to[dp->dirtyNum]   = (toSq == NoSq) ? 64 : nnue_squares[toSq];
+    dp->dirtyNum++;
+}
+
+
+
+// resetAccumulator
+//
+// Invalidate the given accumulator and clear its changed pieces, which is
+// what a null move (or a new root position) looks like to the NNUE.
+static inline void resetAccumulator(NNUEdata &nnue)
+{
+    nnue.accumulator.computedAccumulation = 0;
+    nnue.dirtyPiece.dirtyNum = 0;
+    nnue.dirtyPiece.pc[0] = 0;
+}
 
 
 
@@ -19,14 +19,71 @@
 */
 
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
 
 #include "nnue.h"
+#include "eval.h"
 #include "bitboard.h"
 #include "position.h"
 #include "search.h"
 #include "uci.h"
 #include "tt.h"
-#include "tbprobe.h"
+#include "thread.h"
+#include "tb.h"
+#include "book.h"
+#include "stats.h"
+
+
+
+// checkCPU
+//
+// Verify that the CPU supports the instruction set the binary was built for
+// (see ARCH in the Makefile), and exit with an error message otherwise,
+// rather than crashing with an illegal instruction later on.
+//
+// This runs as a constructor before any other static initialization, and it
+// is compiled for the baseline x86_64 instruction set, so that the check
+// itself runs on any CPU.
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((constructor(101), noinline, target("arch=x86-64")))
+static void checkCPU()
+{
+    const char *missing = nullptr;
+
+
+    __builtin_cpu_init();
+
+#if defined(USE_VNNI)
+    if (!__builtin_cpu_supports("avx512vnni") || !__builtin_cpu_supports("avx512vl"))
+        missing = "AVX-512 VNNI";
+#endif
+#if defined(USE_AVX512)
+    if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512bw"))
+        missing = "AVX-512";
+#endif
+#if defined(USE_BMI2)
+    if (!__builtin_cpu_supports("bmi2"))
+        missing = "BMI2";
+#endif
+#if defined(USE_AVX2)
+    if (!__builtin_cpu_supports("avx2"))
+        missing = "AVX2";
+#endif
+#if defined(USE_SSE41)
+    if (!__builtin_cpu_supports("sse4.1") || !__builtin_cpu_supports("popcnt"))
+        missing = "SSE4.1/POPCNT";
+#endif
+
+
+    if (missing)
+    {
+        fprintf(stderr, "This CPU does not support %s: please use a Gargantua binary built "
+                        "for an older architecture (see ARCH in the Makefile).\n", missing);
+        exit(EXIT_FAILURE);
+    }
+}
+#endif
 
 
 
@@ -47,20 +104,16 @@ int main(int argc, char *argv[])
     initBitboards();
     initRandomKeys();
     initSearch();
+    Stats::attach();
 
 
     // initialize hash table (cache)
     TT::init(1024);
 
 
-    // initialize tablebases (syzygy)
-    // if (options["SyzygyPath"] != "")
-    //     tb_init(options["SyzygyPath"])   
-    // SyzygyPath = syzygy -- by default
-
-
     // initialize neural network (NNUE) for evaluation
-    nnue_init("nn-eba324f53044.nnue");
+    if (!nnue_init(EvalFileDefault))
+        cout << "info string Cannot load the neural network " << EvalFileDefault << endl;
 
 
     // enter UCI loop
@@ -68,6 +121,18 @@ int main(int argc, char *argv[])
     UCI::loop(argc, argv);
 
 
+    // stop the search, if any, and terminate the search threads
+    Threads::shutdown();
+
+
+    // unmap the tablebases (syzygy), if any were loaded with "SyzygyPath"
+    TB::free();
+
+
+    // unmap the opening book, if any was loaded with "BookFile"
+    Book::free();
+
+
     // terminate program
     return 0;
 }
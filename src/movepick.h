@@ -0,0 +1,288 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+
+  Copyright (C) 2024 Claudio M. Camacho
+
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MOVEPICK_H
+#define MOVEPICK_H
+
+#include "movgen.h"
+#include "search.h"
+
+
+
+/*  =========================================
+         Move picking stages (staged search)
+    =========================================
+
+    1. TT move
+    2. PV move
+    3. Good captures and promotions, by MVV/LVA (see() >= 0)
+    4. 1st killer move
+    5. 2nd killer move
+    6. Quiet moves, by history
+    7. Bad captures (see() < 0)
+
+    Moves are generated lazily: if the TT move (or any other early move)
+    produces a beta cut-off, the rest of the moves are never generated, and
+    only the captures are generated if a good capture cuts off the search.
+*/
+enum
+{
+    StageTTMove, StagePVMove, StageGenCaptures, StageGoodCaptures,
+    StageKiller1, StageKiller2, StageGenQuiets, StageQuiets,
+    StageBadCaptures, StageDone
+};
+
+
+
+// MovePicker_t is a structure holding the state of the move picker for a
+// node of the search: the current stage, the moves generated so far (with
+// their score), as well as the special moves that are searched first.
+typedef struct
+{
+    int stage;
+    bool qsearch;
+
+
+    // TT move, PV move and killer moves
+    int ttMove, pvMove, killer1, killer2;
+
+
+    // captures & promotions: bad captures are moved to the front of the list
+    // (i.e., [0, badCount)) once they have been tried out as good captures
+    MoveList_t captures;
+    int captureScores[256];
+    int captureIndex, badCount, badIndex;
+
+
+    // quiet moves
+    MoveList_t quiets;
+    int quietScores[256];
+    int quietIndex;
+} MovePicker_t;
+
+
+
+// initMovePicker
+//
+// Prepare a move picker to pick the moves of the current node. The TT move
+// has been probed by the caller and it's only searched if it's legal in this
+// position (it could come from a hash key collision). In qsearch mode,
+// only good captures and promotions are picked.
+static inline void initMovePicker(Position_t &pos, MovePicker_t &mp, int ttMove, bool qsearch)
+{
+    mp.qsearch  = qsearch;
+    mp.stage    = qsearch ? StageGenCaptures : StageTTMove;
+    mp.ttMove   = (!qsearch && ttMove && isPseudoLegal(pos, ttMove) && isLegal(pos, ttMove)) ? ttMove : 0;
+    mp.pvMove   = 0;
+    mp.killer1  = qsearch ? 0 : killers[0][pos.ply];
+    mp.killer2  = qsearch ? 0 : killers[1][pos.ply];
+    mp.badCount = 0;
+}
+
+
+
+// isSpecialMove
+//
+// Tell whether a move is searched in one of the early stages of the move
+// picker, so that it's not searched twice.
+static inline bool isSpecialMove(MovePicker_t &mp, int move)
+{
+    return (move == mp.ttMove) || (move == mp.pvMove) || (move == mp.killer1) || (move == mp.killer2);
+}
+
+
+
+// pickBest
+//
+// Find the move with the highest score from index 'first' onwards, and swap
+// it with the move at index 'first' (i.e., one pass of a selection sort).
+// This is much cheaper than sorting the whole move list when the search
+// fails high after the first few moves.
+static inline int pickBest(MoveList_t &MoveList, int *scores, int first)
+{
+    int best = first;
+
+
+    // look for the best score
+    for (int i = first + 1; i < MoveList.count; i++)
+        if (scores[i] > scores[best])
+            best = i;
+
+
+    // bring the best move to the front
+    swap(MoveList.moves[first], MoveList.moves[best]);
+    swap(scores[first], scores[best]);
+
+    return MoveList.moves[first];
+}
+
+
+
+// nextMove
+//
+// Return the next move to search in the current node, or 0 when there are no
+// more moves left. All the moves returned are legal.
+static inline int nextMove(Position_t &pos, MovePicker_t &mp)
+{
+    int move;
+
+
+    switch (mp.stage)
+    {
+        // the TT move is searched before generating any moves
+        case StageTTMove:
+            mp.stage = StagePVMove;
+            if (mp.ttMove)
+                return mp.ttMove;
+
+            [[fallthrough]];
+
+
+        // if we are following the PV line, search the PV move next: if it's
+        // not available in this position, we stop following the PV line
+        case StagePVMove:
+            mp.stage = StageGenCaptures;
+            if (followPV)
+            {
+                move = pv_table[0][pos.ply];
+                followPV = move && isPseudoLegal(pos, move) && isLegal(pos, move);
+
+                if (followPV)
+                {
+                    mp.pvMove = move;
+                    if (move != mp.ttMove)
+                        return move;
+                }
+            }
+
+            [[fallthrough]];
+
+
+        // generate and score all the captures and promotions
+        case StageGenCaptures:
+            generateCapturesAndPromotions(pos, mp.captures);
+
+            for (int i = 0; i < mp.captures.count; i++)
+                mp.captureScores[i] = scoreMove(pos, mp.captures.moves[i]);
+
+            mp.captureIndex = 0;
+            mp.stage = StageGoodCaptures;
+
+            [[fallthrough]];
+
+
+        // good captures first, by MVV/LVA; captures losing material are
+        // left for the end of the move list (or skipped in qsearch)
+        case StageGoodCaptures:
+            while (mp.captureIndex < mp.captures.count)
+            {
+                move = pickBest(mp.captures, mp.captureScores, mp.captureIndex++);
+
+                if ((move == mp.ttMove) || (move == mp.pvMove))
+                    continue;
+
+                if (see(pos, move) < 0)
+                {
+                    mp.captures.moves[mp.badCount++] = move;
+                    continue;
+                }
+
+                return move;
+            }
+
+            if (mp.qsearch)
+            {
+                mp.stage = StageDone;
+                return 0;
+            }
+
+            mp.stage = StageKiller1;
+
+            [[fallthrough]];
+
+
+        // killer moves are quiet moves, but quiet promotions have been
+        // searched already with the rest of the promotions
+        case StageKiller1:
+            mp.stage = StageKiller2;
+            move = mp.killer1;
+            if (move && (move != mp.ttMove) && (move != mp.pvMove) && !getPromo(move)
+                     && isPseudoLegal(pos, move) && isLegal(pos, move))
+                return move;
+
+            [[fallthrough]];
+
+
+        case StageKiller2:
+            mp.stage = StageGenQuiets;
+            move = mp.killer2;
+            if (move && (move != mp.ttMove) && (move != mp.pvMove) && (move != mp.killer1) && !getPromo(move)
+                     && isPseudoLegal(pos, move) && isLegal(pos, move))
+                return move;
+
+            [[fallthrough]];
+
+
+        // generate and score the quiet moves by history
+        case StageGenQuiets:
+            generateQuietMoves(pos, mp.quiets);
+
+            for (int i = 0; i < mp.quiets.count; i++)
+                mp.quietScores[i] = history[getMovePiece(mp.quiets.moves[i])][getMoveTarget(mp.quiets.moves[i])];
+
+            mp.quietIndex = 0;
+            mp.stage = StageQuiets;
+
+            [[fallthrough]];
+
+
+        case StageQuiets:
+            while (mp.quietIndex < mp.quiets.count)
+            {
+                move = pickBest(mp.quiets, mp.quietScores, mp.quietIndex++);
+
+                if (!isSpecialMove(mp, move))
+                    return move;
+            }
+
+            mp.badIndex = 0;
+            mp.stage = StageBadCaptures;
+
+            [[fallthrough]];
+
+
+        // captures losing material, in the order they were picked
+        case StageBadCaptures:
+            if (mp.badIndex < mp.badCount)
+                return mp.captures.moves[mp.badIndex++];
+
+            mp.stage = StageDone;
+
+            [[fallthrough]];
+
+
+        default:
+            return 0;
+    }
+}
+
+
+
+#endif  //  MOVEPICK_H
@@ -31,17 +31,133 @@ using namespace std;
 
 
 
-// generateMoves
+// Types of moves to be generated by generate():
+//
+// GenAll       all legal moves
+// GenCaptures  captures (enpassant included) and promotions
+// GenQuiets    the rest of the moves, i.e., neither captures nor promotions
+enum GenType { GenAll, GenCaptures, GenQuiets };
+
+
+
+// attackersTo
+//
+// Return the pieces of both sides attacking a square, given an occupancy of
+// the board (which allows looking through pieces that are about to move).
+static inline Bitboard attackersTo(const Position_t &pos, int sq, Bitboard occupancy)
+{
+    return (PawnAttacks[Black][sq] & pos.bitboards[P])
+         | (PawnAttacks[White][sq] & pos.bitboards[p])
+         | (KnightAttacks[sq] & (pos.bitboards[N] | pos.bitboards[n]))
+         | (getBishopAttacks(sq, occupancy) & (pos.bitboards[B] | pos.bitboards[b] | pos.bitboards[Q] | pos.bitboards[q]))
+         | (getRookAttacks(sq, occupancy) & (pos.bitboards[R] | pos.bitboards[r] | pos.bitboards[Q] | pos.bitboards[q]))
+         | (KingAttacks[sq] & (pos.bitboards[K] | pos.bitboards[k]));
+}
+
+
+
+// pinnedPieces
+//
+// Return the pieces of the given side that are pinned to their own King,
+// i.e., the only piece standing between the King and an enemy slider.
+static inline Bitboard pinnedPieces(const Position_t &pos, int ksq, int us)
+{
+    int theirs = (us == White) ? p : P;
+    Bitboard pinned = 0ULL;
+
+
+    // enemy sliders that would attack the King on an empty board
+    Bitboard snipers = (getRookAttacks(ksq, 0ULL) & (pos.bitboards[theirs + R] | pos.bitboards[theirs + Q]))
+                     | (getBishopAttacks(ksq, 0ULL) & (pos.bitboards[theirs + B] | pos.bitboards[theirs + Q]));
+
+    while (snipers)
+    {
+        Bitboard blockers = BetweenBB[ksq][popLsb(snipers)] & pos.occupancies[Both];
+
+        if (blockers && !(blockers & (blockers - 1)) && (blockers & pos.occupancies[us]))
+            pinned |= blockers;
+    }
+
+
+    return pinned;
+}
+
+
+
+// isLegalEp
 //
-// Generate all pseudo-legal moves for the current position.
-void generateMoves(MoveList_t &MoveList)
+// Enpassant captures remove two pieces from the same rank at once, so they
+// are checked by looking at the board after the capture: no slider of the
+// opponent can attack the King, and any other checking piece must be the
+// captured pawn.
+static inline bool isLegalEp(const Position_t &pos, int fromSq, int toSq, int ksq, Bitboard checkers)
+{
+    int us     = pos.sideToMove;
+    int theirs = (us == White) ? p : P;
+    int capSq  = (us == White) ? toSq + 8 : toSq - 8;
+
+
+    // occupancy after the enpassant capture
+    Bitboard occupancy = (pos.occupancies[Both] ^ SqBB[fromSq] ^ SqBB[capSq]) | SqBB[toSq];
+
+
+    if (getRookAttacks(ksq, occupancy) & (pos.bitboards[theirs + R] | pos.bitboards[theirs + Q]))
+        return false;
+
+    if (getBishopAttacks(ksq, occupancy) & (pos.bitboards[theirs + B] | pos.bitboards[theirs + Q]))
+        return false;
+
+
+    return !(checkers & (pos.bitboards[theirs + P] | pos.bitboards[theirs + N]) & ~SqBB[capSq]);
+}
+
+
+
+// generate
+//
+// Generate the legal moves of the given type for the current position.
+//
+// Checking pieces and pinned pieces are computed once, so that every move
+// generated can be masked accordingly: when in check, pieces other than the
+// King can only capture the checking piece or block its line (and only the
+// King can move in double checks), pinned pieces can only move along the
+// line of the pin, and the King can't move to an attacked square.
+static inline void generate(Position_t &pos, MoveList_t &MoveList, GenType type)
 {
     int fromSq, toSq;
     Bitboard attacks = 0ULL;
 
 
-    // Bitboard containing the pieces for the side on move
-    Bitboard Us = occupancies[sideToMove];
+    // side to move, its first piece (Pawn) and the square of its King
+    int us    = pos.sideToMove;
+    int them  = us ^ 1;
+    int first = (us == White) ? P : p;
+    int ksq   = ls1b(pos.bitboards[first + K]);
+
+
+    // pieces checking our King, and our pieces pinned to our King
+    Bitboard checkers = attackersTo(pos, ksq, pos.occupancies[Both]) & pos.occupancies[them];
+    Bitboard pinned   = pinnedPieces(pos, ksq, us);
+
+
+    // target squares for the type of moves generated
+    Bitboard targets = ~pos.occupancies[us];
+    if (type == GenCaptures)
+        targets = pos.occupancies[them];
+    else if (type == GenQuiets)
+        targets = ~pos.occupancies[Both];
+
+
+    // squares where the pieces other than the King can go to evade a check
+    Bitboard evasions = ~0ULL;
+    if (checkers)
+        evasions = (checkers & (checkers - 1)) ? 0ULL : (BetweenBB[ksq][ls1b(checkers)] | checkers);
+
+
+    // pawn directions and special ranks of the side to move
+    int push           = (us == White) ? -8 : 8;
+    Bitboard startRank = (us == White) ? Rank2_Mask : Rank7_Mask;
+    Bitboard lastRank  = (us == White) ? Rank8_Mask : Rank1_Mask;
 
 
     // start with an empty move list
@@ -49,770 +165,348 @@ void generateMoves(MoveList_t &MoveList)
 
 
     // iterate over all the pieces from the side on move
+    Bitboard Us = pos.occupancies[us];
     while (Us)
     {
         // get next piece and its location, then clean it from the "Us" Bitboard
         fromSq = popLsb(Us);
+        int piece = pos.board[fromSq];
 
 
-        // White Pawns
-        if (SqBB[fromSq] & bitboards[P])
-        {
-            // init target square
-            toSq = fromSq - 8;
-
-            // generate quiet pawn moves
-            if (!(toSq < a8) && !getBit(occupancies[Both], toSq))
-            {
-                // pawn promotions
-                if (SqBB[toSq] & Rank8_Mask)
-                {                            
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, Q, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, R, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, B, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, N, 0, 0, 0, 0));
-                }
-                
-                else
-                {
-                    // one-square pawn push
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, 0, 0, 0, 0, 0));
-                    
-                    // double pawn push
-                    if ((SqBB[fromSq] & Rank2_Mask) && !(SqBB[toSq - 8] & occupancies[Both]))
-                        addMove(MoveList, encodeMove(fromSq, (toSq - 8), P, 0, 0, 1, 0, 0));
-                }
-            }
-                    
-            // init pawn attacks bitboard
-            attacks = PawnAttacks[White][fromSq] & occupancies[Black];
-            
-            // generate pawn captures
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);
-                
-                // pawn promotions with capture
-                if (SqBB[toSq] & Rank8_Mask)
-                {
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, Q, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, R, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, B, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, N, 1, 0, 0, 0));
-                }
-                
-                else
-                    // one-square pawn push
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, 0, 1, 0, 0, 0));
-            }
-                    
-            // generate enpassant captures
-            if (epsq != NoSq)
-            {
-                // lookup pawn attacks and bitwise AND with enpassant square (bit)
-                Bitboard enpassant_attacks = PawnAttacks[White][fromSq] & (1ULL << epsq);
-                        
-                // make sure enpassant capture available
-                if (enpassant_attacks)
-                {
-                    // init enpassant capture target square
-                    int target_enpassant = ls1b(enpassant_attacks);
-                    addMove(MoveList, encodeMove(fromSq, target_enpassant, P, 0, 1, 0, 1, 0));
-                }
-            }
-        }
+        // squares allowed for this piece, unless it's the King
+        Bitboard allowed = evasions;
+        if (pinned & SqBB[fromSq])
+            allowed &= LineBB[ksq][fromSq];
 
 
-        // Black Pawns
-        else if (SqBB[fromSq] & bitboards[p])
+        // Pawns
+        if (piece == first)
         {
-            // init target square
-            toSq = fromSq + 8;
-            
-            // generate quiet pawn moves
-            if (!(toSq > h1) && !getBit(occupancies[Both], toSq))
+            toSq = fromSq + push;
+
+
+            // pawn pushes (pawns never stand on the last rank)
+            if (!getBit(pos.occupancies[Both], toSq))
             {
                 // pawn promotions
-                if (SqBB[toSq] & Rank1_Mask)
+                if (SqBB[toSq] & lastRank)
                 {
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, q, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, r, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, b, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, n, 0, 0, 0, 0));
+                    if ((type != GenQuiets) && (allowed & SqBB[toSq]))
+                    {
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + Q), 0, 0, 0, 0));
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + R), 0, 0, 0, 0));
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + B), 0, 0, 0, 0));
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + N), 0, 0, 0, 0));
+                    }
                 }
-                
-                else
+
+                else if (type != GenCaptures)
                 {
                     // one-square pawn push
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, 0, 0, 0, 0, 0));
-                    
+                    if (allowed & SqBB[toSq])
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, 0, 0, 0, 0, 0));
+
                     // double pawn push
-                    if ((SqBB[fromSq] & Rank7_Mask) && !(SqBB[toSq + 8] & occupancies[Both]))
-                        addMove(MoveList, encodeMove(fromSq, (toSq + 8), p, 0, 0, 1, 0, 0));
-                }
-            }
-            
-            // init pawn attacks bitboard
-            attacks = PawnAttacks[Black][fromSq] & occupancies[White];
-            
-            // generate pawn captures
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);
-                
-                // pawn promotions with capture
-                if (SqBB[toSq] & Rank1_Mask)
-                {
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, q, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, r, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, b, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, n, 1, 0, 0, 0));
+                    if ((SqBB[fromSq] & startRank) && !getBit(pos.occupancies[Both], toSq + push)
+                                                   && (allowed & SqBB[toSq + push]))
+                        addMove(MoveList, encodeMove(fromSq, (toSq + push), piece, 0, 0, 1, 0, 0));
                 }
-                
-                else
-                    // one-square ahead pawn move
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, 0, 1, 0, 0, 0));
             }
 
-            // generate enpassant captures
-            if (epsq != NoSq)
+
+            // pawn captures
+            if (type != GenQuiets)
             {
-                // lookup pawn attacks and bitwise AND with enpassant square (bit)
-                Bitboard enpassant_attacks = PawnAttacks[Black][fromSq] & (1ULL << epsq);
-                
-                // make sure enpassant capture available
-                if (enpassant_attacks)
+                attacks = PawnAttacks[us][fromSq] & pos.occupancies[them] & allowed;
+                while (attacks)
                 {
-                    // init enpassant capture target square
-                    int target_enpassant = ls1b(enpassant_attacks);
-                    addMove(MoveList, encodeMove(fromSq, target_enpassant, p, 0, 1, 0, 1, 0));
-                }
-            }
-        }
+                    toSq = popLsb(attacks);
 
+                    // pawn promotions with capture
+                    if (SqBB[toSq] & lastRank)
+                    {
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + Q), 1, 0, 0, 0));
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + R), 1, 0, 0, 0));
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + B), 1, 0, 0, 0));
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, (first + N), 1, 0, 0, 0));
+                    }
 
-        // White Knights
-        else if (SqBB[fromSq] & bitboards[N])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = KnightAttacks[fromSq] & ~occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[Black] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, N, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, N, 0, 1, 0, 0, 0));
-            }
-        }
+                    // regular capture (without promotion)
+                    else
+                        addMove(MoveList, encodeMove(fromSq, toSq, piece, 0, 1, 0, 0, 0));
+                }
 
 
-        // Black Knights
-        else if (SqBB[fromSq] & bitboards[n])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = KnightAttacks[fromSq] & ~occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[White] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, n, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, n, 0, 1, 0, 0, 0));
+                // enpassant captures
+                if ((pos.epsq != NoSq) && (PawnAttacks[us][fromSq] & SqBB[pos.epsq])
+                                       && isLegalEp(pos, fromSq, pos.epsq, ksq, checkers))
+                    addMove(MoveList, encodeMove(fromSq, pos.epsq, piece, 0, 1, 0, 1, 0));
             }
         }
 
 
-        // White Bishops
-        else if (SqBB[fromSq] & bitboards[B])
+        // King: it can't move to an attacked square, including the squares
+        // behind it on the line of a checking slider
+        else if (piece == first + K)
         {
-            // init piece attacks in order to get set of target squares
-            attacks = getBishopAttacks(fromSq, occupancies[Both]) & ~occupancies[White];
-            
-            // loop over target squares available from generated attacks
+            Bitboard occupancy = pos.occupancies[Both] ^ SqBB[fromSq];
+
+            attacks = KingAttacks[fromSq] & targets;
             while (attacks)
             {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[Black] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, B, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, B, 0, 1, 0, 0, 0));
+                toSq = popLsb(attacks);
+
+                if (!(attackersTo(pos, toSq, occupancy) & pos.occupancies[them]))
+                    addMove(MoveList, encodeMove(fromSq, toSq, piece, 0, getBit(pos.occupancies[them], toSq), 0, 0, 0));
             }
-        }
 
 
-        // Black Bishops
-        else if (SqBB[fromSq] & bitboards[b])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = getBishopAttacks(fromSq, occupancies[Both]) & ~occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
+            // castling: short (0-0) and long (0-0-0), never out of check
+            if ((type != GenCaptures) && !checkers)
             {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[White] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, b, 0, 0, 0, 0, 0));
-                
+                if (us == White)
+                {
+                    if ((pos.castle & wk) && !(FG1_Mask & pos.occupancies[Both]))
+                        if (!isSquareAttacked(pos, f1, Black) && !isSquareAttacked(pos, g1, Black))
+                            addMove(MoveList, encodeMove(e1, g1, K, 0, 0, 0, 0, 1));
+
+                    if ((pos.castle & wq) && !(DCB1_Mask & pos.occupancies[Both]))
+                        if (!isSquareAttacked(pos, d1, Black) && !isSquareAttacked(pos, c1, Black))
+                            addMove(MoveList, encodeMove(e1, c1, K, 0, 0, 0, 0, 1));
+                }
                 else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, b, 0, 1, 0, 0, 0));
+                {
+                    if ((pos.castle & bk) && !(FG8_Mask & pos.occupancies[Both]))
+                        if (!isSquareAttacked(pos, f8, White) && !isSquareAttacked(pos, g8, White))
+                            addMove(MoveList, encodeMove(e8, g8, k, 0, 0, 0, 0, 1));
+
+                    if ((pos.castle & bq) && !(DCB8_Mask & pos.occupancies[Both]))
+                        if (!isSquareAttacked(pos, d8, White) && !isSquareAttacked(pos, c8, White))
+                            addMove(MoveList, encodeMove(e8, c8, k, 0, 0, 0, 0, 1));
+                }
             }
         }
 
 
-        // White Rooks
-        else if (SqBB[fromSq] & bitboards[R])
+        // Knights, Bishops, Rooks and Queens
+        else
         {
-            // init piece attacks in order to get set of target squares
-            attacks = getRookAttacks(fromSq, occupancies[Both]) & ~occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
+            switch (piece - first)
             {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[Black] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, R, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, R, 0, 1, 0, 0, 0));
+                case N:  attacks = KnightAttacks[fromSq]; break;
+                case B:  attacks = getBishopAttacks(fromSq, pos.occupancies[Both]); break;
+                case R:  attacks = getRookAttacks(fromSq, pos.occupancies[Both]); break;
+                default: attacks = getQueenAttacks(fromSq, pos.occupancies[Both]); break;
             }
-        }
 
-
-        // Black Rooks
-        else if (SqBB[fromSq] & bitboards[r])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = getRookAttacks(fromSq, occupancies[Both]) & ~occupancies[Black];
-            
-            // loop over target squares available from generated attacks
+            attacks &= targets & allowed;
             while (attacks)
             {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[White] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, r, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, r, 0, 1, 0, 0, 0));
+                toSq = popLsb(attacks);
+                addMove(MoveList, encodeMove(fromSq, toSq, piece, 0, getBit(pos.occupancies[them], toSq), 0, 0, 0));
             }
         }
+    }
+}
 
 
-        // White Queens
-        else if (SqBB[fromSq] & bitboards[Q])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = getQueenAttacks(fromSq, occupancies[Both]) & ~occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[Black] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, Q, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, Q, 0, 1, 0, 0, 0));
-            }
-        }
 
+// generateMoves
+//
+// Generate all legal moves for the current position.
+void generateMoves(Position_t &pos, MoveList_t &MoveList)
+{
+    generate(pos, MoveList, GenAll);
+}
 
-        // Black Queens
-        else if (SqBB[fromSq] & bitboards[q])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = getQueenAttacks(fromSq, occupancies[Both]) & ~occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[White] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, q, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, q, 0, 1, 0, 0, 0));
-            }
-        }
 
 
-        // White King
-        else if (SqBB[fromSq] & bitboards[K])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = KingAttacks[fromSq] & ~occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[Black] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, K, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, K, 0, 1, 0, 0, 0));
-            }
-                    
-            // short castle 0-0
-            if (castle & wk)
-            {
-                if (!(FG1_Mask & occupancies[Both]))
-                {
-                    if (!isSquareAttacked(e1, Black) &&
-                        !isSquareAttacked(f1, Black) &&
-                        !isSquareAttacked(g1, Black))
-                    {
-                        addMove(MoveList, encodeMove(e1, g1, K, 0, 0, 0, 0, 1));
-                    }
-                }
-            }
-            
-            // long castle 0-0-0
-            if (castle & wq)
-            {
-                if (!(DCB1_Mask & occupancies[Both]))
-                {
-                    if (!isSquareAttacked(e1, Black) &&
-                        !isSquareAttacked(d1, Black) &&
-                        !isSquareAttacked(c1, Black))
-                    {
-                        addMove(MoveList, encodeMove(e1, c1, K, 0, 0, 0, 0, 1));
-                    }
-                }
-            }
-        }
+// generateCapturesAndPromotions
+//
+// Generate all legal captures and promotions for the current position.
+// This is typically used by the quiescence search.
+void generateCapturesAndPromotions(Position_t &pos, MoveList_t &MoveList)
+{
+    generate(pos, MoveList, GenCaptures);
+}
 
 
-        // Black King
-        else if (SqBB[fromSq] & bitboards[k])
-        {
-            // init piece attacks in order to get set of target squares
-            attacks = KingAttacks[fromSq] & ~occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (attacks)
-            {
-                // init target square
-                toSq = popLsb(attacks);    
-                
-                // quiet move
-                if (!(occupancies[White] & SqBB[toSq]))
-                    addMove(MoveList, encodeMove(fromSq, toSq, k, 0, 0, 0, 0, 0));
-                
-                else
-                    // capture move
-                    addMove(MoveList, encodeMove(fromSq, toSq, k, 0, 1, 0, 0, 0));
-            }
 
-            // short castle 0-0
-            if (castle & bk)
-            {
-                if (!(FG8_Mask & occupancies[Both]))
-                {
-                    if (!isSquareAttacked(e8, White) &&
-                        !isSquareAttacked(f8, White) &&
-                        !isSquareAttacked(g8, White))
-                    {
-                        addMove(MoveList, encodeMove(e8, g8, k, 0, 0, 0, 0, 1));
-                    }
-                }
-            }
-            
-            // long castle 0-0-0
-            if (castle & bq)
-            {
-                if (!(DCB8_Mask & occupancies[Both]))
-                {
-                    if (!isSquareAttacked(e8, White) &&
-                        !isSquareAttacked(d8, White) &&
-                        !isSquareAttacked(c8, White))
-                    {
-                        addMove(MoveList, encodeMove(e8, c8, k, 0, 0, 0, 0, 1));
-                    }
-                }
-            }
-        }
-    }
+// generateQuietMoves
+//
+// Generate all legal quiet moves (i.e., neither captures nor promotions) for
+// the current position, castling included. Together with
+// generateCapturesAndPromotions(), this generates the same moves as
+// generateMoves(), so that the search can generate them in stages.
+void generateQuietMoves(Position_t &pos, MoveList_t &MoveList)
+{
+    generate(pos, MoveList, GenQuiets);
 }
 
 
 
-// generateCapturesAndPromotions
+// isLegal
 //
-// Generate all pseudo-legal captures and promotions for the current position.
-// This is typically used by the quiescence search.
-void generateCapturesAndPromotions(MoveList_t &MoveList)
+// Check whether a pseudo-legal move (see isPseudoLegal()) leaves the King of
+// the side to move out of check, i.e., whether generateMoves() would generate
+// it. Pseudo-legal castling moves are always legal.
+bool isLegal(Position_t &pos, int move)
 {
-    int fromSq, toSq;
-    Bitboard captures = 0ULL;
+    int fromSq = getMoveSource(move);
+    int toSq   = getMoveTarget(move);
+    int piece  = getMovePiece(move);
 
 
-    // Bitboard containing the pieces for the side on move
-    Bitboard Us = occupancies[sideToMove];
+    // side to move and the square of its King
+    int us    = pos.sideToMove;
+    int them  = us ^ 1;
+    int first = (us == White) ? P : p;
+    int ksq   = ls1b(pos.bitboards[first + K]);
 
 
-    // start with an empty move list
-    MoveList.count = 0;
+    // King moves can't go to attacked squares
+    if (piece == first + K)
+        return getCastle(move) || !(attackersTo(pos, toSq, pos.occupancies[Both] ^ SqBB[fromSq]) & pos.occupancies[them]);
 
 
-    // iterate over all the pieces from the side on move
-    while (Us)
+    // pieces checking our King
+    Bitboard checkers = attackersTo(pos, ksq, pos.occupancies[Both]) & pos.occupancies[them];
+
+
+    if (getEp(move))
+        return isLegalEp(pos, fromSq, toSq, ksq, checkers);
+
+
+    // captures of the checking piece or blocks of its line (single checks)
+    if (checkers)
     {
-        // get next piece and its location, then clean it from the "Us" Bitboard
-        fromSq = popLsb(Us);
+        if (checkers & (checkers - 1))
+            return false;
 
+        if (!((BetweenBB[ksq][ls1b(checkers)] | checkers) & SqBB[toSq]))
+            return false;
+    }
 
-        // White Pawns
-        if (SqBB[fromSq] & bitboards[P])
-        {
-            // init target square
-            toSq = fromSq - 8;
 
-            // generate pawn promotions
-            if (!(toSq < a8) && !getBit(occupancies[Both], toSq))
-            {
-                // pawn promotions
-                if (SqBB[toSq] & Rank8_Mask)
-                {                            
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, Q, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, R, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, B, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, N, 0, 0, 0, 0));
-                }
-            }
-                    
-            // init pawn attacks bitboard
-            captures = PawnAttacks[White][fromSq] & occupancies[Black];
-            
-            // generate pawn captures
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);
-                
-                // pawn promotions with capture
-                if (SqBB[toSq] & Rank8_Mask)
-                {
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, Q, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, R, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, B, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, N, 1, 0, 0, 0));
-                }
-                
-                // regular capture (without promotion)
-                else
-                    addMove(MoveList, encodeMove(fromSq, toSq, P, 0, 1, 0, 0, 0));
-            }
-                    
-            // generate enpassant captures
-            if (epsq != NoSq)
-            {
-                // lookup pawn attacks and bitwise AND with enpassant square (bit)
-                Bitboard ep_captures = PawnAttacks[White][fromSq] & (1ULL << epsq);
-                        
-                // make sure enpassant capture available
-                if (ep_captures)
-                {
-                    // init enpassant capture target square
-                    int target_enpassant = ls1b(ep_captures);
-                    addMove(MoveList, encodeMove(fromSq, target_enpassant, P, 0, 1, 0, 1, 0));
-                }
-            }
-        }
+    // pinned pieces can only move along the line of the pin
+    return !(pinnedPieces(pos, ksq, us) & SqBB[fromSq]) || (LineBB[ksq][fromSq] & SqBB[toSq]);
+}
 
 
-        // Black Pawns
-        else if (SqBB[fromSq] & bitboards[p])
-        {
-            // init target square
-            toSq = fromSq + 8;
-            
-            // generate pawn promotions
-            if (!(toSq > h1) && !getBit(occupancies[Both], toSq))
-            {
-                // pawn promotions
-                if (SqBB[toSq] & Rank1_Mask)
-                {
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, q, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, r, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, b, 0, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, n, 0, 0, 0, 0));
-                }
-            }
-            
-            // init pawn attacks bitboard
-            captures = PawnAttacks[Black][fromSq] & occupancies[White];
-            
-            // generate pawn captures
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);
-                
-                // pawn promotions with capture
-                if (SqBB[toSq] & Rank1_Mask)
-                {
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, q, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, r, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, b, 1, 0, 0, 0));
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, n, 1, 0, 0, 0));
-                }
-                
-                // regular capture (without promotion)
-                else
-                    addMove(MoveList, encodeMove(fromSq, toSq, p, 0, 1, 0, 0, 0));
-            }
 
-            // generate enpassant captures
-            if (epsq != NoSq)
-            {
-                // lookup pawn attacks and bitwise AND with enpassant square (bit)
-                Bitboard ep_captures = PawnAttacks[Black][fromSq] & (1ULL << epsq);
-                
-                // make sure enpassant capture available
-                if (ep_captures)
-                {
-                    // init enpassant capture target square
-                    int target_enpassant = ls1b(ep_captures);
-                    addMove(MoveList, encodeMove(fromSq, target_enpassant, p, 0, 1, 0, 1, 0));
-                }
-            }
-        }
+// isPseudoLegal
+//
+// Check whether a move that was not generated in the current position (e.g.,
+// a move from the TT or a killer move) is pseudo-legal in this position, i.e.,
+// it follows the rules of movement of its piece, regardless of whether it
+// leaves its own King in check (see isLegal()).
+bool isPseudoLegal(Position_t &pos, int move)
+{
+    // parse move components
+    int fromSq   = getMoveSource(move);
+    int toSq     = getMoveTarget(move);
+    int piece    = getMovePiece(move);
+    int promo    = getPromo(move);
+    bool capture = getMoveCapture(move);
+    bool dpush   = getDoublePush(move);
+    bool ep      = getEp(move);
+    bool castling = getCastle(move);
 
 
-        // White Knights
-        else if (SqBB[fromSq] & bitboards[N])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = KnightAttacks[fromSq] & occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[Black] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, N, 0, 1, 0, 0, 0));
-            }
-        }
+    // side to move and its first piece (Pawn)
+    int us    = pos.sideToMove;
+    int them  = us ^ 1;
+    int first = (us == White) ? P : p;
 
 
-        // Black Knights
-        else if (SqBB[fromSq] & bitboards[n])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = KnightAttacks[fromSq] & occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[White] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, n, 0, 1, 0, 0, 0));
-            }
-        }
+    // there must be a piece of the side to move on the source square, and
+    // the target square can't hold a piece of its own
+    if (!move || (piece < first) || (piece > first + K))
+        return false;
 
+    if (!getBit(pos.bitboards[piece], fromSq) || getBit(pos.occupancies[us], toSq))
+        return false;
 
-        // White Bishops
-        else if (SqBB[fromSq] & bitboards[B])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = getBishopAttacks(fromSq, occupancies[Both]) & occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[Black] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, B, 0, 1, 0, 0, 0));
-            }
-        }
 
+    // the capture flag must match the target square
+    if (capture != (getBit(pos.occupancies[them], toSq) || ep))
+        return false;
 
-        // Black Bishops
-        else if (SqBB[fromSq] & bitboards[b])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = getBishopAttacks(fromSq, occupancies[Both]) & occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[White] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, b, 0, 1, 0, 0, 0));
-            }
-        }
 
+    // Pawn moves
+    if (piece == first)
+    {
+        bool lastRank = SqBB[toSq] & (Rank8_Mask | Rank1_Mask);
+        int  push     = (us == White) ? -8 : 8;
 
-        // White Rooks
-        else if (SqBB[fromSq] & bitboards[R])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = getRookAttacks(fromSq, occupancies[Both]) & occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[Black] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, R, 0, 1, 0, 0, 0));
-            }
-        }
+        if (castling || (lastRank != (promo != 0)))
+            return false;
 
+        if (promo && ((promo <= first) || (promo >= first + K)))
+            return false;
 
-        // Black Rooks
-        else if (SqBB[fromSq] & bitboards[r])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = getRookAttacks(fromSq, occupancies[Both]) & occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[White] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, r, 0, 1, 0, 0, 0));
-            }
-        }
+        if (ep)
+            return (toSq == pos.epsq) && (PawnAttacks[us][fromSq] & SqBB[toSq]) && !dpush;
 
+        if (capture)
+            return (PawnAttacks[us][fromSq] & SqBB[toSq]) && !dpush;
 
-        // White Queens
-        else if (SqBB[fromSq] & bitboards[Q])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = getQueenAttacks(fromSq, occupancies[Both]) & occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[Black] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, Q, 0, 1, 0, 0, 0));
-            }
-        }
+        if (dpush)
+            return (toSq == fromSq + 2 * push)
+                && (SqBB[fromSq] & ((us == White) ? Rank2_Mask : Rank7_Mask))
+                && !getBit(pos.occupancies[Both], fromSq + push);
 
+        return toSq == fromSq + push;
+    }
 
-        // Black Queens
-        else if (SqBB[fromSq] & bitboards[q])
-        {
-            // init piece attacks in order to get set of target squares
-            captures = getQueenAttacks(fromSq, occupancies[Both]) & occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[White] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, q, 0, 1, 0, 0, 0));
-            }
-        }
+
+    // no other piece can promote, push or capture enpassant
+    if (promo || dpush || ep)
+        return false;
 
 
-        // White King
-        else if (SqBB[fromSq] & bitboards[K])
+    // castling moves are made of the King going to its castling square
+    if (castling)
+    {
+        if (us == White)
         {
-            // init piece attacks in order to get set of target squares
-            captures = KingAttacks[fromSq] & occupancies[Black];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[Black] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, K, 0, 1, 0, 0, 0));
-            }
-        }
+            if ((piece != K) || (fromSq != e1) || isSquareAttacked(pos, e1, Black))
+                return false;
 
+            if (toSq == g1)
+                return (pos.castle & wk) && !(FG1_Mask & pos.occupancies[Both])
+                    && !isSquareAttacked(pos, f1, Black) && !isSquareAttacked(pos, g1, Black);
 
-        // Black King
-        else if (SqBB[fromSq] & bitboards[k])
+            if (toSq == c1)
+                return (pos.castle & wq) && !(DCB1_Mask & pos.occupancies[Both])
+                    && !isSquareAttacked(pos, d1, Black) && !isSquareAttacked(pos, c1, Black);
+        }
+        else
         {
-            // init piece attacks in order to get set of target squares
-            captures = KingAttacks[fromSq] & occupancies[White];
-            
-            // loop over target squares available from generated attacks
-            while (captures)
-            {
-                // init target square
-                toSq = popLsb(captures);    
-                
-                // capture move
-                if (occupancies[White] & SqBB[toSq])
-                    addMove(MoveList, encodeMove(fromSq, toSq, k, 0, 1, 0, 0, 0));
-            }
+            if ((piece != k) || (fromSq != e8) || isSquareAttacked(pos, e8, White))
+                return false;
+
+            if (toSq == g8)
+                return (pos.castle & bk) && !(FG8_Mask & pos.occupancies[Both])
+                    && !isSquareAttacked(pos, f8, White) && !isSquareAttacked(pos, g8, White);
+
+            if (toSq == c8)
+                return (pos.castle & bq) && !(DCB8_Mask & pos.occupancies[Both])
+                    && !isSquareAttacked(pos, d8, White) && !isSquareAttacked(pos, c8, White);
         }
+
+        return false;
+    }
+
+
+    // the rest of the pieces must attack the target square
+    switch (piece - first)
+    {
+        case N:  return KnightAttacks[fromSq] & SqBB[toSq];
+        case B:  return getBishopAttacks(fromSq, pos.occupancies[Both]) & SqBB[toSq];
+        case R:  return getRookAttacks(fromSq, pos.occupancies[Both]) & SqBB[toSq];
+        case Q:  return getQueenAttacks(fromSq, pos.occupancies[Both]) & SqBB[toSq];
+        default: return KingAttacks[fromSq] & SqBB[toSq];
     }
 }
 
@@ -820,7 +514,7 @@ void generateCapturesAndPromotions(MoveList_t &MoveList)
 
 // printMoveList
 //
-// Print the list of generated pseudo-legal moves.
+// Print the list of generated legal moves.
 void printMoveList(MoveList_t &MoveList)
 {
     // reliability check
@@ -28,6 +28,7 @@
 #include "bitboard.h"
 #include "position.h"
 #include "tt.h"
+#include "eval.h"
 
 
 
@@ -138,8 +139,11 @@ static constexpr int castling_rights[64] =
 
 
 // Functionality to generate and manipulate chess moves.
-void generateMoves(MoveList_t &);
-void generateCapturesAndPromotions(MoveList_t &);
+void generateMoves(Position_t &, MoveList_t &);
+void generateCapturesAndPromotions(Position_t &, MoveList_t &);
+void generateQuietMoves(Position_t &, MoveList_t &);
+bool isPseudoLegal(Position_t &, int);
+bool isLegal(Position_t &, int);
 void printMoveList(MoveList_t &);
 
 
@@ -199,7 +203,7 @@ static inline void addMove(MoveList_t &MoveList, int move)
 // isSquareAttacked
 //
 // True if the given square is attacked by any piece an opponent's piece.
-constexpr bool isSquareAttacked(int square, int side)
+constexpr bool isSquareAttacked(const Position_t &pos, int square, int side)
 {
     // reliability checks
     assert((side == White) || (side == Black));
@@ -207,35 +211,35 @@ constexpr bool isSquareAttacked(int square, int side)
 
 
     // square attacked by White or Black pawns
-    if ((side == White) && (PawnAttacks[Black][square] & bitboards[P]))
+    if ((side == White) && (PawnAttacks[Black][square] & pos.bitboards[P]))
         return true;
 
-    if ((side == Black) && (PawnAttacks[White][square] & bitboards[p]))
+    if ((side == Black) && (PawnAttacks[White][square] & pos.bitboards[p]))
         return true;
    
 
     // square attacked by Knights
-    if (KnightAttacks[square] & ((side == White) ? bitboards[N] : bitboards[n]))
+    if (KnightAttacks[square] & ((side == White) ? pos.bitboards[N] : pos.bitboards[n]))
         return true;
 
     
     // square attacked by Bishops
-    if (getBishopAttacks(square, occupancies[Both]) & ((side == White) ? bitboards[B] : bitboards[b]))
+    if (getBishopAttacks(square, pos.occupancies[Both]) & ((side == White) ? pos.bitboards[B] : pos.bitboards[b]))
         return true;
 
 
     // square attacked by Rooks
-    if (getRookAttacks(square, occupancies[Both]) & ((side == White) ? bitboards[R] : bitboards[r]))
+    if (getRookAttacks(square, pos.occupancies[Both]) & ((side == White) ? pos.bitboards[R] : pos.bitboards[r]))
         return true;
 
 
     // square attacked by Queens
-    if (getQueenAttacks(square, occupancies[Both]) & ((side == White) ? bitboards[Q] : bitboards[q]))
+    if (getQueenAttacks(square, pos.occupancies[Both]) & ((side == White) ? pos.bitboards[Q] : pos.bitboards[q]))
         return true;
 
     
     // square attacked by Kings
-    if (KingAttacks[square] & ((side == White) ? bitboards[K] : bitboards[k]))
+    if (KingAttacks[square] & ((side == White) ? pos.bitboards[K] : pos.bitboards[k]))
         return true;
 
 
@@ -245,46 +249,108 @@ constexpr bool isSquareAttacked(int square, int side)
 
 
 
-// saveBoard
+// putPiece
 //
-// Implemented as a macro, it's job is to preserve the current board state
-// in temporary variables.
-#define saveBoard()                                                       \
-    Bitboard bitboards_copy[12], occupancies_copy[3];                     \
-    int side_copy, enpassant_copy, castle_copy, fifty_copy;               \
-    memcpy(bitboards_copy, bitboards, sizeof(bitboards));                 \
-    memcpy(occupancies_copy, occupancies, sizeof(occupancies));           \
-    side_copy = sideToMove, enpassant_copy = epsq, castle_copy = castle;  \
-    fifty_copy = fifty;                                                   \
-    uint64_t hash_key_copy = hash_key;                                    \
+// Place a piece on an empty square, updating the bitboards, the mailbox and
+// the NNUE piece list (but not the hash key, nor occupancies[Both]).
+static inline void putPiece(Position_t &pos, int piece, int sq)
+{
+    // reliability checks
+    assert(pos.board[sq] == NoPiece);
+    assert((piece == K) || (piece == k) || (pos.pieceCount < 32));
 
 
+    // bitboards and mailbox
+    setBit(pos.bitboards[piece], sq);
+    setBit(pos.occupancies[(piece < p) ? White : Black], sq);
+    pos.board[sq] = piece;
 
-// takeBack
+
+    // append the piece to the piece list, except for the Kings
+    int index = (piece == K) ? 0 : (piece == k) ? 1 : pos.pieceCount++;
+    pos.pieceIndex[sq]       = index;
+    pos.nnuePieces[index]    = nnue_pieces[piece];
+    pos.nnueSquares[index]   = nnue_squares[sq];
+    pos.nnuePieces[pos.pieceCount]  = 0;
+    pos.nnueSquares[pos.pieceCount] = 0;
+}
+
+
+
+// removePiece
 //
-// Implemented as a macro, it's job is to restore the previous board state
-// from temporary variables. Because this is a macro, it needs to be used
-// in conjunction with saveBoard() within the same scope.
-#define takeBack()                                                        \
-    memcpy(bitboards, bitboards_copy, sizeof(bitboards));                 \
-    memcpy(occupancies, occupancies_copy, sizeof(occupancies));           \
-    sideToMove = side_copy, epsq = enpassant_copy, castle = castle_copy;  \
-    fifty = fifty_copy;                                                   \
-    hash_key = hash_key_copy;                                             \
+// Remove the piece standing on the given square (other than a King), which
+// is replaced in the piece list by the last piece of the list.
+static inline void removePiece(Position_t &pos, int sq)
+{
+    int piece = pos.board[sq];
+
 
+    // reliability checks
+    assert((piece != NoPiece) && (piece != K) && (piece != k));
 
 
-// makeMove
+    // bitboards and mailbox
+    popBit(pos.bitboards[piece], sq);
+    popBit(pos.occupancies[(piece < p) ? White : Black], sq);
+    pos.board[sq] = NoPiece;
+
+
+    // fill the gap in the piece list with its last piece: NNUE squares are
+    // flipped vertically, so the same table translates them back
+    int index = pos.pieceIndex[sq];
+    int last  = --pos.pieceCount;
+
+    pos.nnuePieces[index]  = pos.nnuePieces[last];
+    pos.nnueSquares[index] = pos.nnueSquares[last];
+    pos.pieceIndex[nnue_squares[pos.nnueSquares[last]]] = index;
+
+    pos.nnuePieces[last]  = 0;
+    pos.nnueSquares[last] = 0;
+}
+
+
+
+// movePiece
 //
-// Make move (thus alter the position) on the chess board.
+// Move a piece from a square to an empty square.
+static inline void movePiece(Position_t &pos, int fromSq, int toSq)
+{
+    int piece = pos.board[fromSq];
+    Bitboard fromTo = SqBB[fromSq] | SqBB[toSq];
+
+
+    // reliability checks
+    assert((piece != NoPiece) && (pos.board[toSq] == NoPiece));
+
+
+    // bitboards and mailbox
+    pos.bitboards[piece] ^= fromTo;
+    pos.occupancies[(piece < p) ? White : Black] ^= fromTo;
+    pos.board[fromSq] = NoPiece;
+    pos.board[toSq]   = piece;
+
+
+    // the piece keeps its place in the piece list
+    int index = pos.pieceIndex[fromSq];
+    pos.pieceIndex[toSq]   = index;
+    pos.nnueSquares[index] = nnue_squares[toSq];
+}
+
+
+
+// makeMove
 //
-// Note: remember to save the board status (saveBoard) before calling
-//       makeMove(), if you then want to be able to use takeBack().
-static inline int makeMove(int move)
+// Make a legal move (thus alter the position) on the chess board. The move
+// generators only generate legal moves, so makeMove() doesn't check legality.
+// The information needed to take the move back is pushed on the undo stack of
+// the position, to be restored by takeBack().
+static inline void makeMove(Position_t &pos, int move)
 {
     //reliability checks
     assert(move);
-    assert((sideToMove == White) || (sideToMove == Black));
+    assert((pos.sideToMove == White) || (pos.sideToMove == Black));
+    assert(pos.gamePly < MaxGamePly);
 
 
     // parse move components
@@ -298,277 +364,310 @@ static inline int makeMove(int move)
     int castling = getCastle(move);
 
 
-    // configure opponent's color
-    int Them     = White;
-    if (sideToMove == White)
-        Them = Black;
-       
+    // push the current state on the undo stack
+    StateInfo_t *st = &pos.states[pos.gamePly++];
+    st->move     = move;
+    st->captured = NoPiece;
+    st->castle   = pos.castle;
+    st->epsq     = pos.epsq;
+    st->fifty    = pos.fifty;
+    st->hash_key = pos.hash_key;
 
-    // move the piece from source to target
-    popBit(bitboards[piece], fromSq);
-    setBit(bitboards[piece], toSq);
 
+    // start recording the pieces changed by this move, so that the NNUE
+    // accumulator of the new ply can be updated incrementally (a promoted
+    // pawn disappears from the board, the promoted piece is added below)
+    DirtyPiece *dp = &pos.nnue[pos.ply].dirtyPiece;
+    pos.nnue[pos.ply].accumulator.computedAccumulation = 0;
+    dp->dirtyNum = 0;
+    addDirtyPiece(dp, piece, fromSq, promo ? NoSq : toSq);
 
-    // update occupancies for the piece being moved
-    popBit(occupancies[sideToMove], fromSq);
-    setBit(occupancies[sideToMove], toSq);
 
+    // remove the captured piece first, so that the target square is empty
+    // (enpassant captures remove a pawn behind the target square)
+    if (capture)
+    {
+        int capSq = toSq;
+        if (ep)
+            capSq = (pos.sideToMove == White) ? toSq + 8 : toSq - 8;
 
-    // remove and set piece from source to target square in the hash key
-    hash_key ^= piece_keys[piece][fromSq] ^ piece_keys[piece][toSq];
 
+        // remember the captured piece to take the move back
+        st->captured = pos.board[capSq];
 
-    // increment fifty move rule counter
-    if ((piece != P) && (piece != p))
-        fifty++;
 
+        // remove the captured piece from the board and the hash key
+        removePiece(pos, capSq);
+        pos.hash_key ^= piece_keys[st->captured][capSq];
 
-    // handle castling moves
-    if (castling)
-    {
-        // four different possibilities: white and black, 0-0 and 0-0-0
-        switch (toSq)
-        {
-            // white castles king side (0-0)
-            case (g1):
-                // move rook from h1
-                popBit(bitboards[R], h1);
-                setBit(bitboards[R], f1);
-
-                // update occupancies
-                popBit(occupancies[White], h1);
-                setBit(occupancies[White], f1);
-                
-                // hash rook
-                hash_key ^= piece_keys[R][h1] ^ piece_keys[R][f1];
-
-                break;
-           
-
-            // white castles queen side (0-0-0)
-            case (c1):
-                // move rook from a1
-                popBit(bitboards[R], a1);
-                setBit(bitboards[R], d1);
-
-                // update occupancies
-                popBit(occupancies[White], a1);
-                setBit(occupancies[White], d1);
-                
-                // hash rook
-                hash_key ^= piece_keys[R][a1] ^ piece_keys[R][d1];
-
-                break;
-           
-
-            // black castles king side (0-0)
-            case (g8):
-                // move rook from h8
-                popBit(bitboards[r], h8);
-                setBit(bitboards[r], f8);
-
-                // update occupancies
-                popBit(occupancies[Black], h8);
-                setBit(occupancies[Black], f8);
-                
-                // hash rook
-                hash_key ^= piece_keys[r][h8] ^ piece_keys[r][f8];
-
-                break;
-           
-
-            // black castles queen side (0-0-0)
-            case (c8):
-                // move rook from a8
-                popBit(bitboards[r], a8);
-                setBit(bitboards[r], d8);
-
-                // update occupancies
-                popBit(occupancies[Black], a8);
-                setBit(occupancies[Black], d8);
-                
-                // hash rook
-                hash_key ^= piece_keys[r][a8] ^ piece_keys[r][d8];
-
-                break;
-        }
-    }
-                
 
-    // after the moving piece, also handle the captured piece, if any
-    if (capture)
-    {
-        // reset fifty move rule counter
-        fifty = 0;
+        // record captured piece for the NNUE
+        addDirtyPiece(dp, st->captured, capSq, NoSq);
 
-        
-        // pick up bitboard piece index ranges depending on side
-        int start_piece, end_piece;
-       
 
-        // configure side to move (in order to reduce the piece)
-        if (sideToMove == White)
-        {
-            start_piece = p;
-            end_piece = k;
-        }
-        else
-        {
-            start_piece = P;
-            end_piece = K;
-        }
+        // reset fifty move rule counter
+        pos.fifty = 0;
+    }
 
-        
-        // if there's a piece on the target, remove it from the bitboard
-        for (int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
-        {
-            if (getBit(bitboards[bb_piece], toSq))
-            {
-                // remove the captured piece from the target square
-                popBit(bitboards[bb_piece], toSq);
 
-                // update occupancies for the piece just removed
-                popBit(occupancies[Them], toSq);
+    // move the piece from source to target, unless it's a pawn promotion,
+    // in which case the pawn is replaced by the promoted piece
+    if (promo)
+    {
+        removePiece(pos, fromSq);
+        putPiece(pos, promo, toSq);
+        pos.hash_key ^= piece_keys[piece][fromSq] ^ piece_keys[promo][toSq];
+
 
-                // remove the piece from hash key
-                hash_key ^= piece_keys[bb_piece][toSq];
+        // record promoted piece for the NNUE
+        addDirtyPiece(dp, promo, NoSq, toSq);
+    }
+    else
+    {
+        movePiece(pos, fromSq, toSq);
+        pos.hash_key ^= piece_keys[piece][fromSq] ^ piece_keys[piece][toSq];
+    }
 
-                break;
-            }
-        }
 
+    // reset fifty move rule counter on pawn moves, increment it otherwise
+    // (captures have reset it already)
+    if ((piece == P) || (piece == p))
+        pos.fifty = 0;
 
-        // handle enpassant captures
-        if (ep)
-        {
-            // white to move
-            if (sideToMove == White)
-            {
-                // remove captured pawn
-                popBit(bitboards[p], toSq + 8);
-
-                // update occupancies
-                popBit(occupancies[Black], toSq + 8);
-
-                // remove pawn from hash key
-                hash_key ^= piece_keys[p][toSq + 8];
-            }
-           
-
-            // black to move
-            else
-            {
-                // remove captured pawn
-                popBit(bitboards[P], toSq - 8);
-
-                // update occupancies
-                popBit(occupancies[White], toSq - 8);
-
-                // remove pawn from hash key
-                hash_key ^= piece_keys[P][toSq - 8];
-            }
-        }
-    }
+    else if (!capture)
+        pos.fifty++;
 
 
-    // handle pawn promotions
-    if (promo)
+    // handle castling moves: move the rook from its corner too
+    if (castling)
     {
-        // white to move
-        if (sideToMove == White)
-        {
-            // erase the pawn from the target square
-            popBit(bitboards[P], toSq);
+        int rook = (pos.sideToMove == White) ? R : r;
+        int rookFrom, rookTo;
 
-            // remove pawn from hash key
-            hash_key ^= piece_keys[P][toSq];
-        }
 
-        
-        // black to move
-        else
+        // four different possibilities: white and black, 0-0 and 0-0-0
+        switch (toSq)
         {
-            // erase the pawn from the target square
-            popBit(bitboards[p], toSq);
-            
-            // remove pawn from hash key
-            hash_key ^= piece_keys[p][toSq];
+            case (g1): rookFrom = h1; rookTo = f1; break;
+            case (c1): rookFrom = a1; rookTo = d1; break;
+            case (g8): rookFrom = h8; rookTo = f8; break;
+            default:   rookFrom = a8; rookTo = d8; break;
         }
 
-        
-        // set promoted piece on the chess board
-        setBit(bitboards[promo], toSq);
 
-        
-        // add promoted piece into the hash key
-        hash_key ^= piece_keys[promo][toSq];
+        // move and hash the rook
+        movePiece(pos, rookFrom, rookTo);
+        pos.hash_key ^= piece_keys[rook][rookFrom] ^ piece_keys[rook][rookTo];
+
+
+        // record rook for the NNUE
+        addDirtyPiece(dp, rook, rookFrom, rookTo);
     }
 
 
 
     // hash enpassant if available (remove enpassant square from hash key)
-    if (epsq != NoSq)
-        hash_key ^= enpassant_keys[epsq];
+    if (pos.epsq != NoSq)
+        pos.hash_key ^= enpassant_keys[pos.epsq];
    
 
     // reset enpassant square
-    epsq = NoSq;
+    pos.epsq = NoSq;
 
 
     // handle double pawn pushes
     if (dpush)
     {
         // white to move
-        if (sideToMove == White)
+        if (pos.sideToMove == White)
         {
             // set enpassant square
-            epsq = toSq + 8;
+            pos.epsq = toSq + 8;
             
             // hash enpassant
-            hash_key ^= enpassant_keys[toSq + 8];
+            pos.hash_key ^= enpassant_keys[toSq + 8];
         }
         
         // black to move
         else
         {
             // set enpassant square
-            epsq = toSq - 8;
+            pos.epsq = toSq - 8;
             
             // hash enpassant
-            hash_key ^= enpassant_keys[toSq - 8];
+            pos.hash_key ^= enpassant_keys[toSq - 8];
         }
     }
 
 
     // hash castling
-    hash_key ^= castle_keys[castle];
+    pos.hash_key ^= castle_keys[pos.castle];
 
     
     // update castling rights
-    castle &= castling_rights[fromSq];
-    castle &= castling_rights[toSq];
+    pos.castle &= castling_rights[fromSq];
+    pos.castle &= castling_rights[toSq];
 
 
     // re-hash castling after updating castling rights
-    hash_key ^= castle_keys[castle];
+    pos.hash_key ^= castle_keys[pos.castle];
 
 
     // update all occupancies
-    occupancies[Both] = occupancies[White] | occupancies[Black];
+    pos.occupancies[Both] = pos.occupancies[White] | pos.occupancies[Black];
 
 
     // change side to move
-    sideToMove ^= 1;
-    hash_key ^= side_key;
+    pos.sideToMove ^= 1;
+    pos.hash_key ^= side_key;
 
-    
-    // check if move is legal (return 0 for illegal move, 1 for legal)
-    if (!isSquareAttacked((sideToMove == White) ? ls1b(bitboards[k]) : ls1b(bitboards[K]), sideToMove))
-        return 1;
 
-    
-    // return 0 as 'illegal move' if nothing happens
-    return 0;
+    // the hash key is updated incrementally, check it against a full
+    // computation in debug builds
+    assert(pos.hash_key == generateHashkey(pos));
+
+
+    // the hash key of the new position is ready: prefetch its TT bucket
+    TT::prefetch(pos.hash_key);
+}
+
+
+
+// takeBack
+//
+// Take back the last move made with makeMove(), restoring the position from
+// the move itself and the state saved on top of the undo stack.
+static inline void takeBack(Position_t &pos)
+{
+    // reliability checks
+    assert(pos.gamePly > 0);
+
+
+    // pop the state saved by makeMove()
+    StateInfo_t *st = &pos.states[--pos.gamePly];
+
+
+    // parse move components
+    int move   = st->move;
+    int fromSq = getMoveSource(move);
+    int toSq   = getMoveTarget(move);
+    int piece  = getMovePiece(move);
+    int promo  = getPromo(move);
+
+
+    // change side to move back to the side that made the move
+    pos.sideToMove ^= 1;
+    int Us   = pos.sideToMove;
+
+
+    // remove the promoted piece and put the pawn back, or move the piece
+    // from target back to source
+    if (promo)
+    {
+        removePiece(pos, toSq);
+        putPiece(pos, piece, fromSq);
+    }
+    else
+        movePiece(pos, toSq, fromSq);
+
+
+    // move the castling rook back to its corner
+    if (getCastle(move))
+    {
+        switch (toSq)
+        {
+            case (g1): movePiece(pos, f1, h1); break;
+            case (c1): movePiece(pos, d1, a1); break;
+            case (g8): movePiece(pos, f8, h8); break;
+            default:   movePiece(pos, d8, a8); break;
+        }
+    }
+
+
+    // put the captured piece back on the board
+    if (st->captured != NoPiece)
+    {
+        int capSq = toSq;
+        if (getEp(move))
+            capSq = (Us == White) ? toSq + 8 : toSq - 8;
+
+        putPiece(pos, st->captured, capSq);
+    }
+
+
+    // update all occupancies
+    pos.occupancies[Both] = pos.occupancies[White] | pos.occupancies[Black];
+
+
+    // restore the state that cannot be recomputed from the move
+    pos.castle   = st->castle;
+    pos.epsq     = st->epsq;
+    pos.fifty    = st->fifty;
+    pos.hash_key = st->hash_key;
+}
+
+
+
+// makeNullMove
+//
+// Pass the turn to the opponent without moving any piece. The null move is
+// pushed on the undo stack too, and must be taken back with takeNullMove().
+static inline void makeNullMove(Position_t &pos)
+{
+    // reliability checks
+    assert(pos.gamePly < MaxGamePly);
+
+
+    // push the current state on the undo stack
+    StateInfo_t *st = &pos.states[pos.gamePly++];
+    st->move     = 0;
+    st->captured = NoPiece;
+    st->castle   = pos.castle;
+    st->epsq     = pos.epsq;
+    st->fifty    = pos.fifty;
+    st->hash_key = pos.hash_key;
+
+
+    // no pieces change on the board for the NNUE accumulator
+    resetAccumulator(pos.nnue[pos.ply]);
+
+
+    // hash enpassant if available
+    if (pos.epsq != NoSq)
+        pos.hash_key ^= enpassant_keys[pos.epsq];
+
+
+    // reset enpassant capture square
+    pos.epsq = NoSq;
+
+
+    // switch the side, literally giving opponent an extra move to make
+    pos.sideToMove ^= 1;
+    pos.hash_key ^= side_key;
+
+
+    // prefetch the TT bucket of the new position
+    TT::prefetch(pos.hash_key);
+}
+
+
+
+// takeNullMove
+//
+// Take back the last null move made with makeNullMove().
+static inline void takeNullMove(Position_t &pos)
+{
+    // reliability checks
+    assert(pos.gamePly > 0);
+
+
+    // pop the state saved by makeNullMove()
+    StateInfo_t *st = &pos.states[--pos.gamePly];
+
+
+    pos.sideToMove ^= 1;
+    pos.epsq     = st->epsq;
+    pos.hash_key = st->hash_key;
 }
 
 
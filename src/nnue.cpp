@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 //--------------------
 #ifdef _MSC_VER
@@ -92,17 +93,29 @@ enum {
   SHIFT = 6
 };
 
+// Topology of the network: HalfKP[41024->256x2]-32-32-1. The SIMD code of
+// the hidden layers is specialized for layers of 32 outputs.
 enum {
-  kHalfDimensions = 256,
+  kHalfDimensions = NNUE_HALF_DIMENSIONS,
   FtInDims = 64 * PS_END, // 64 * 641
-  FtOutDims = kHalfDimensions * 2
+  FtOutDims = kHalfDimensions * 2,
+  L1Dims = 32,
+  L2Dims = 32
 };
 
+static_assert(L1Dims == 32 && L2Dims == 32, "hidden layers must have 32 outputs");
+
 // USE_MMX generates _mm_empty() instructions, so undefine if not needed
 #if defined(USE_SSE2)
 #undef USE_MMX
 #endif
 
+// SSE4.1 implies SSSE3, whose pmaddubsw lets the hidden layers use int8
+// weights (as AVX2 does) instead of the int16 weights of plain SSE2
+#if defined(USE_SSE41) && !defined(USE_SSSE3)
+#define USE_SSSE3
+#endif
+
 static_assert(kHalfDimensions % 256 == 0, "kHalfDimensions should be a multiple of 256");
 
 #define VECTOR
@@ -184,7 +197,7 @@ typedef uint32_t mask2_t;
 #endif
 
 typedef int8_t clipped_t;
-#if defined(USE_MMX) || (defined(USE_SSE2) && !defined(USE_AVX2))
+#if defined(USE_MMX) || (defined(USE_SSE2) && !defined(USE_SSSE3))
 typedef int16_t weight_t;
 #else
 typedef int8_t weight_t;
@@ -280,17 +293,29 @@ static void append_changed_indices(const Position *pos, IndexList removed[2],
 // 32 x clipped_t -> 1 x int32_t
 
 #if !defined(USE_AVX512)
-static weight_t hidden1_weights alignas(64) [32 * 512];
-static weight_t hidden2_weights alignas(64) [32 * 32];
+#define HIDDEN_ROWS 32
 #else
-static weight_t hidden1_weights alignas(64) [64 * 512];
-static weight_t hidden2_weights alignas(64) [64 * 32];
+#define HIDDEN_ROWS 64
 #endif
-static weight_t output_weights alignas(64) [1 * 32];
 
-static int32_t hidden1_biases alignas(64) [32];
-static int32_t hidden2_biases alignas(64) [32];
-static int32_t output_biases[1];
+// All the weights of the network, in the (permuted) layout used by the SIMD
+// code of this build. The weights are read from the network file into
+// 'private_net', or they are memory-mapped, read-only, from a cache file
+// created beforehand (see nnue_write_cache()), so that all the engine
+// processes share the same copy, in the page cache of the OS.
+typedef struct {
+  alignas(64) int16_t ft_biases[kHalfDimensions];
+  alignas(64) int16_t ft_weights[kHalfDimensions * FtInDims];
+  alignas(64) weight_t hidden1_weights[HIDDEN_ROWS * FtOutDims];
+  alignas(64) weight_t hidden2_weights[HIDDEN_ROWS * L1Dims];
+  alignas(64) weight_t output_weights[1 * L2Dims];
+  alignas(64) int32_t hidden1_biases[L1Dims];
+  alignas(64) int32_t hidden2_biases[L2Dims];
+  alignas(64) int32_t output_biases[1];
+} NetWeights;
+
+static NetWeights private_net;
+static NetWeights *net = &private_net;
 
 INLINE int32_t affine_propagate(clipped_t *input, int32_t *biases,
     weight_t *weights)
@@ -312,7 +337,7 @@ INLINE int32_t affine_propagate(clipped_t *input, int32_t *biases,
 #elif defined(USE_SSE2)
   __m128i *iv = (__m128i *)input;
   __m128i *row = (__m128i *)weights;
-#if defined(AVOID_USE_SSSE3)
+#if defined(USE_SSSE3)
   const __m128i kOnes = _mm_set1_epi16(1);
   __m128i p0 = _mm_madd_epi16(_mm_maddubs_epi16(iv[0], row[0]), kOnes);
   __m128i p1 = _mm_madd_epi16(_mm_maddubs_epi16(iv[1], row[1]), kOnes);
@@ -368,8 +393,9 @@ INLINE int32_t affine_propagate(clipped_t *input, int32_t *biases,
 static_assert(FtOutDims % 64 == 0, "FtOutDims not a multiple of 64");
 
 #ifdef VECTOR
+template <unsigned inDims>
 INLINE bool next_idx(unsigned *idx, unsigned *offset, mask2_t *v,
-    mask_t *mask, unsigned inDims)
+    mask_t *mask)
 {
   while (*v == 0) {
     *offset += 8 * sizeof(mask2_t);
@@ -410,13 +436,11 @@ INLINE int neon_movemask(uint8x16_t v)
 #endif
 
 #if defined(USE_AVX512)
-INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
-    unsigned outDims, const int32_t *biases, const weight_t *weights,
+template <unsigned inDims>
+INLINE void affine_txfm(int8_t *input, void *output,
+    const int32_t *biases, const weight_t *weights,
     mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask)
 {
-  assert(outDims == 32);
-
-  (void)outDims;
   const __m512i kZero = _mm512_setzero_si512();
   __m512i out_0 = ((__m512i *)biases)[0];
   __m512i out_1 = ((__m512i *)biases)[1];
@@ -426,11 +450,11 @@ INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
 
   memcpy(&v, inMask, sizeof(mask2_t));
   for (unsigned offset = 0; offset < inDims;) {
-    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+    if (!next_idx<inDims>(&idx, &offset, &v, inMask))
       break;
     first = ((__m512i *)weights)[idx];
     uint16_t factor = input[idx];
-    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+    if (next_idx<inDims>(&idx, &offset, &v, inMask)) {
       second = ((__m512i *)weights)[idx];
       factor |= input[idx] << 8;
     } else {
@@ -455,13 +479,11 @@ INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
     outVec[0] = _mm256_max_epi8(outVec[0], kZero256);
 }
 #elif defined(USE_AVX2)
-INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
-    unsigned outDims, const int32_t *biases, const weight_t *weights,
+template <unsigned inDims>
+INLINE void affine_txfm(int8_t *input, void *output,
+    const int32_t *biases, const weight_t *weights,
     mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask)
 {
-  assert(outDims == 32);
-
-  (void)outDims;
   const __m256i kZero = _mm256_setzero_si256();
   __m256i out_0 = ((__m256i *)biases)[0];
   __m256i out_1 = ((__m256i *)biases)[1];
@@ -473,11 +495,11 @@ INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
 
   memcpy(&v, inMask, sizeof(mask2_t));
   for (unsigned offset = 0; offset < inDims;) {
-    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+    if (!next_idx<inDims>(&idx, &offset, &v, inMask))
       break;
     first = ((__m256i *)weights)[idx];
     uint16_t factor = input[idx];
-    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+    if (next_idx<inDims>(&idx, &offset, &v, inMask)) {
       second = ((__m256i *)weights)[idx];
       factor |= input[idx] << 8;
     } else {
@@ -504,12 +526,13 @@ INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
   else
     outVec[0] = _mm256_max_epi8(outVec[0], kZero);
 }
-#elif AVOID_USE_SSSE3
-INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
-    unsigned outDims, const int32_t *biases, const weight_t *weights,
+#elif defined(USE_SSSE3)
+template <unsigned inDims>
+INLINE void affine_txfm(int8_t *input, void *output,
+    const int32_t *biases, const weight_t *weights,
     mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask)
 {
-  assert(outDims == 32);
+  const unsigned outDims = 32;
 
   const __m128i kZeros[2] = { 0 };
   __m128i out_0 = ((__m128i *)biases)[0];
@@ -526,11 +549,11 @@ INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
 
   memcpy(&v, inMask, sizeof(mask2_t));
   for (unsigned offset = 0; offset < inDims;) {
-    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+    if (!next_idx<inDims>(&idx, &offset, &v, inMask))
       break;
     first = (__m128i *)&weights[outDims * idx];
     uint16_t factor = input[idx];
-    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+    if (next_idx<inDims>(&idx, &offset, &v, inMask)) {
       second = (__m128i *)&weights[outDims * idx];
       factor |= input[idx] << 8;
     } else {
@@ -579,11 +602,12 @@ INLINE void affine_txfm(int8_t *input, void *output, unsigned inDims,
   }
 }
 #elif defined(USE_SSE2)
-INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
-    unsigned outDims, const int32_t *biases, const weight_t *weights,
+template <unsigned inDims>
+INLINE void affine_txfm(clipped_t *input, void *output,
+    const int32_t *biases, const weight_t *weights,
     mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask)
 {
-  assert(outDims == 32);
+  const unsigned outDims = 32;
 
   const __m128i kZeros[4] = { 0 };
   __m128i out_0 = ((__m128i *)biases)[0];
@@ -600,11 +624,11 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
 
   memcpy(&v, inMask, sizeof(mask2_t));
   for (unsigned offset = 0; offset < inDims;) {
-    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+    if (!next_idx<inDims>(&idx, &offset, &v, inMask))
       break;
     first = (__m128i *)&weights[outDims * idx];
     uint32_t factor = input[idx];
-    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+    if (next_idx<inDims>(&idx, &offset, &v, inMask)) {
       second = (__m128i *)&weights[outDims * idx];
       factor |= input[idx] << 16;
     } else {
@@ -641,11 +665,12 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
   }
 }
 #elif defined(USE_MMX)
-INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
-    unsigned outDims, const int32_t *biases, const weight_t *weights,
+template <unsigned inDims>
+INLINE void affine_txfm(clipped_t *input, void *output,
+    const int32_t *biases, const weight_t *weights,
     mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask)
 {
-  assert(outDims == 32);
+  const unsigned outDims = 32;
 
 #if 0
   const __m64 kZeros[2] = { 0 };
@@ -660,11 +685,11 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
 
     memcpy(&v, inMask, sizeof(mask2_t));
     for (unsigned offset = 0; offset < inDims;) {
-      if (!next_idx(&idx, &offset, &v, inMask, inDims))
+      if (!next_idx<inDims>(&idx, &offset, &v, inMask))
         break;
       first = &((__m64 *)&weights[outDims * idx])[2  * t];
       uint32_t factor = input[idx];
-      if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+      if (next_idx<inDims>(&idx, &offset, &v, inMask)) {
         second = &((__m64 *)&weights[outDims * idx])[2 * t];
         factor |= input[idx] << 16;
       } else {
@@ -722,11 +747,11 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
 
   memcpy(&v, inMask, sizeof(mask2_t));
   for (unsigned offset = 0; offset < inDims;) {
-    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+    if (!next_idx<inDims>(&idx, &offset, &v, inMask))
       break;
     first = (__m64 *)&weights[outDims * idx];
     uint32_t factor = input[idx];
-    if (next_idx(&idx, &offset, &v, inMask, inDims)) {
+    if (next_idx<inDims>(&idx, &offset, &v, inMask)) {
       second = (__m64 *)&weights[outDims * idx];
       factor |= input[idx] << 16;
     } else {
@@ -798,11 +823,12 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
 #endif
 }
 #elif defined(USE_NEON)
-INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
-    unsigned outDims, const int32_t *biases, const weight_t *weights,
+template <unsigned inDims>
+INLINE void affine_txfm(clipped_t *input, void *output,
+    const int32_t *biases, const weight_t *weights,
     mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask)
 {
-  assert(outDims == 32);
+  const unsigned outDims = 32;
 
   int32x4_t out_0 = ((int32x4_t *)biases)[0];
   int32x4_t out_1 = ((int32x4_t *)biases)[1];
@@ -812,28 +838,36 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
   int32x4_t out_5 = ((int32x4_t *)biases)[5];
   int32x4_t out_6 = ((int32x4_t *)biases)[6];
   int32x4_t out_7 = ((int32x4_t *)biases)[7];
-  const int8x8_t *first;
+  const int8x8_t *first, *second;
   mask2_t v;
   unsigned idx;
 
   memcpy(&v, inMask, sizeof(mask2_t));
   for (unsigned offset = 0; offset < inDims;) {
-    if (!next_idx(&idx, &offset, &v, inMask, inDims))
+    if (!next_idx<inDims>(&idx, &offset, &v, inMask))
       break;
     first = (int8x8_t *)&weights[outDims * idx];
-    int16_t factor = input[idx];
+    int8x8_t factor0 = vdup_n_s8(input[idx]), factor1;
+    if (next_idx<inDims>(&idx, &offset, &v, inMask)) {
+      second = (int8x8_t *)&weights[outDims * idx];
+      factor1 = vdup_n_s8(input[idx]);
+    } else {
+      second = first;
+      factor1 = vdup_n_s8(0);
+    }
 
+    // two inputs of at most 127 fit in the int16 products (as in pmaddubsw)
     int16x8_t prod;
-    prod = vmulq_n_s16(vmovl_s8(first[0]), factor);
+    prod = vmlal_s8(vmull_s8(first[0], factor0), second[0], factor1);
     out_0 = vaddq_s32(out_0, vmovl_s16(vget_low_s16(prod)));
     out_1 = vaddq_s32(out_1, vmovl_high_s16(prod));
-    prod = vmulq_n_s16(vmovl_s8(first[1]), factor);
+    prod = vmlal_s8(vmull_s8(first[1], factor0), second[1], factor1);
     out_2 = vaddq_s32(out_2, vmovl_s16(vget_low_s16(prod)));
     out_3 = vaddq_s32(out_3, vmovl_high_s16(prod));
-    prod = vmulq_n_s16(vmovl_s8(first[2]), factor);
+    prod = vmlal_s8(vmull_s8(first[2], factor0), second[2], factor1);
     out_4 = vaddq_s32(out_4, vmovl_s16(vget_low_s16(prod)));
     out_5 = vaddq_s32(out_5, vmovl_high_s16(prod));
-    prod = vmulq_n_s16(vmovl_s8(first[3]), factor);
+    prod = vmlal_s8(vmull_s8(first[3], factor0), second[3], factor1);
     out_6 = vaddq_s32(out_6, vmovl_s16(vget_low_s16(prod)));
     out_7 = vaddq_s32(out_7, vmovl_high_s16(prod));
   }
@@ -861,10 +895,13 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
   }
 }
 #else /* generic fallback */
-INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
-    unsigned outDims, int32_t *biases, const weight_t *weights,
+template <unsigned inDims>
+INLINE void affine_txfm(clipped_t *input, void *output,
+    const int32_t *biases, const weight_t *weights,
     mask_t *inMask, mask_t *outMask, const bool pack8_and_calc_mask)
 {
+  const unsigned outDims = 32;
+
   (void)inMask; (void)outMask; (void)pack8_and_calc_mask;
 
   int32_t tmp[outDims];
@@ -883,10 +920,6 @@ INLINE void affine_txfm(clipped_t *input, void *output, unsigned inDims,
 }
 #endif
 
-// Input feature converter
-static int16_t ft_biases alignas(64) [kHalfDimensions];
-static int16_t ft_weights alignas(64) [kHalfDimensions * FtInDims];
-
 #ifdef VECTOR
 #define TILE_HEIGHT (NUM_REGS * SIMD_WIDTH / 16)
 #endif
@@ -903,7 +936,7 @@ INLINE void refresh_accumulator(Position *pos)
   for (unsigned c = 0; c < 2; c++) {
 #ifdef VECTOR
     for (unsigned i = 0; i < kHalfDimensions / TILE_HEIGHT; i++) {
-      vec16_t *ft_biases_tile = (vec16_t *)&ft_biases[i * TILE_HEIGHT];
+      vec16_t *ft_biases_tile = (vec16_t *)&net->ft_biases[i * TILE_HEIGHT];
       vec16_t *accTile = (vec16_t *)&accumulator->accumulation[c][i * TILE_HEIGHT];
       vec16_t acc[NUM_REGS];
 
@@ -913,7 +946,7 @@ INLINE void refresh_accumulator(Position *pos)
       for (size_t k = 0; k < activeIndices[c].size; k++) {
         unsigned index = activeIndices[c].values[k];
         unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
-        vec16_t *column = (vec16_t *)&ft_weights[offset];
+        vec16_t *column = (vec16_t *)&net->ft_weights[offset];
 
         for (unsigned j = 0; j < NUM_REGS; j++)
           acc[j] = vec_add_16(acc[j], column[j]);
@@ -923,7 +956,7 @@ INLINE void refresh_accumulator(Position *pos)
         accTile[j] = acc[j];
     }
 #else
-    memcpy(accumulator->accumulation[c], ft_biases,
+    memcpy(accumulator->accumulation[c], net->ft_biases,
         kHalfDimensions * sizeof(int16_t));
 
     for (size_t k = 0; k < activeIndices[c].size; k++) {
@@ -931,7 +964,7 @@ INLINE void refresh_accumulator(Position *pos)
       unsigned offset = kHalfDimensions * index;
 
       for (unsigned j = 0; j < kHalfDimensions; j++)
-        accumulator->accumulation[c][j] += ft_weights[offset + j];
+        accumulator->accumulation[c][j] += net->ft_weights[offset + j];
     }
 #endif
   }
@@ -964,7 +997,7 @@ INLINE bool update_accumulator(Position *pos)
       vec16_t acc[NUM_REGS];
 
       if (reset[c]) {
-        vec16_t *ft_b_tile = (vec16_t *)&ft_biases[i * TILE_HEIGHT];
+        vec16_t *ft_b_tile = (vec16_t *)&net->ft_biases[i * TILE_HEIGHT];
         for (unsigned j = 0; j < NUM_REGS; j++)
           acc[j] = ft_b_tile[j];
       } else {
@@ -977,7 +1010,7 @@ INLINE bool update_accumulator(Position *pos)
           unsigned index = removed_indices[c].values[k];
           const unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
 
-          vec16_t *column = (vec16_t *)&ft_weights[offset];
+          vec16_t *column = (vec16_t *)&net->ft_weights[offset];
           for (unsigned j = 0; j < NUM_REGS; j++)
             acc[j] = vec_sub_16(acc[j], column[j]);
         }
@@ -988,7 +1021,7 @@ INLINE bool update_accumulator(Position *pos)
         unsigned index = added_indices[c].values[k];
         const unsigned offset = kHalfDimensions * index + i * TILE_HEIGHT;
 
-        vec16_t *column = (vec16_t *)&ft_weights[offset];
+        vec16_t *column = (vec16_t *)&net->ft_weights[offset];
         for (unsigned j = 0; j < NUM_REGS; j++)
           acc[j] = vec_add_16(acc[j], column[j]);
       }
@@ -1000,7 +1033,7 @@ INLINE bool update_accumulator(Position *pos)
 #else
   for (unsigned c = 0; c < 2; c++) {
     if (reset[c]) {
-      memcpy(accumulator->accumulation[c], ft_biases,
+      memcpy(accumulator->accumulation[c], net->ft_biases,
           kHalfDimensions * sizeof(int16_t));
     } else {
       memcpy(accumulator->accumulation[c], prevAcc->accumulation[c],
@@ -1011,7 +1044,7 @@ INLINE bool update_accumulator(Position *pos)
         const unsigned offset = kHalfDimensions * index;
 
         for (unsigned j = 0; j < kHalfDimensions; j++)
-          accumulator->accumulation[c][j] -= ft_weights[offset + j];
+          accumulator->accumulation[c][j] -= net->ft_weights[offset + j];
       }
     }
 
@@ -1021,7 +1054,7 @@ INLINE bool update_accumulator(Position *pos)
       const unsigned offset = kHalfDimensions * index;
 
       for (unsigned j = 0; j < kHalfDimensions; j++)
-        accumulator->accumulation[c][j] += ft_weights[offset + j];
+        accumulator->accumulation[c][j] += net->ft_weights[offset + j];
     }
   }
 #endif
@@ -1066,11 +1099,11 @@ INLINE void transform(Position *pos, clipped_t *output, mask_t *outMask)
 
 struct NetData {
   alignas(64) clipped_t input[FtOutDims];
-  clipped_t hidden1_out[32];
-#if (defined(USE_SSE2) || defined(USE_MMX)) && !defined(USE_AVX2)
-  int16_t hidden2_out[32];
+  clipped_t hidden1_out[L1Dims];
+#if (defined(USE_SSE2) || defined(USE_MMX)) && !defined(USE_SSSE3)
+  int16_t hidden2_out[L2Dims];
 #else
-  int8_t hidden2_out[32];
+  int8_t hidden2_out[L2Dims];
 #endif
 };
 
@@ -1091,14 +1124,14 @@ int nnue_evaluate_pos(Position *pos)
 
   transform(pos, B(input), input_mask);
 
-  affine_txfm(B(input), B(hidden1_out), FtOutDims, 32,
-      hidden1_biases, hidden1_weights, input_mask, hidden1_mask, true);
+  affine_txfm<FtOutDims>(B(input), B(hidden1_out),
+      net->hidden1_biases, net->hidden1_weights, input_mask, hidden1_mask, true);
 
-  affine_txfm(B(hidden1_out), B(hidden2_out), 32, 32,
-      hidden2_biases, hidden2_weights, hidden1_mask, NULL, false);
+  affine_txfm<L1Dims>(B(hidden1_out), B(hidden2_out),
+      net->hidden2_biases, net->hidden2_weights, hidden1_mask, NULL, false);
 
-  out_value = affine_propagate((int8_t *)B(hidden2_out), output_biases,
-      output_weights);
+  out_value = affine_propagate((int8_t *)B(hidden2_out), net->output_biases,
+      net->output_weights);
 
 #if defined(USE_MMX)
   _mm_empty();
@@ -1109,7 +1142,7 @@ int nnue_evaluate_pos(Position *pos)
 
 static void read_output_weights(weight_t *w, const char *d)
 {
-  for (unsigned i = 0; i < 32; i++) {
+  for (unsigned i = 0; i < L2Dims; i++) {
     unsigned c = i;
 #if defined(USE_AVX512)
     unsigned b = c & 0x18;
@@ -1194,53 +1227,221 @@ static void permute_biases(int32_t *biases)
 }
 #endif
 
-enum {
-  TransformerStart = 3 * 4 + 177,
-  NetworkStart = TransformerStart + 4 + 2 * 256 + 2 * 256 * 64 * 641
-};
+/*
+Network architectures
+*/
 
-static bool verify_net(const void *evalData, size_t size)
+// The hash of each layer of the network is derived from the type of the
+// layer, its size and the hash of its input layer (as the trainer does), so
+// the hash of a network file tells its whole architecture
+constexpr uint32_t affine_hash(uint32_t prevHash, uint32_t outDims)
 {
-  if (size != 21022697) return false;
+  return (0xCC03DAE4u + outDims) ^ (prevHash >> 1) ^ (prevHash << 31);
+}
+
+constexpr uint32_t clipped_relu_hash(uint32_t prevHash)
+{
+  return 0x538D24C7u + prevHash;
+}
 
-  const char *d = (const char*)evalData;
-  if (readu_le_u32(d) != NnueVersion) return false;
-  if (readu_le_u32(d + 4) != 0x3e5aa6eeU) return false;
-  if (readu_le_u32(d + 8) != 177) return false;
-  if (readu_le_u32(d + TransformerStart) != 0x5d69d7b8) return false;
-  if (readu_le_u32(d + NetworkStart) != 0x63337156) return false;
+// HalfKP(Friend)[41024->256x2]-32-32-1
+static constexpr uint32_t HalfKPHash = 0x5D69D5B9u ^ 1;
+static constexpr uint32_t HalfKPTransformerHash = HalfKPHash ^ FtOutDims;
+static constexpr uint32_t HalfKPNetworkHash =
+  affine_hash(clipped_relu_hash(affine_hash(clipped_relu_hash(
+      affine_hash(0xEC42E90Du ^ FtOutDims, L1Dims)), L2Dims)), 1);
+
+static constexpr size_t HalfKPTransformerSize =
+  4 + 2 * kHalfDimensions + 2 * kHalfDimensions * FtInDims;
+static constexpr size_t HalfKPNetworkSize =
+  4 + 4 * L1Dims + L1Dims * FtOutDims + 4 * L2Dims + L2Dims * L1Dims
+    + 4 + L2Dims;
+
+static bool halfkp_verify(const char *d, size_t size)
+{
+  if (size != HalfKPTransformerSize + HalfKPNetworkSize) return false;
+  if (readu_le_u32(d) != HalfKPTransformerHash) return false;
+  if (readu_le_u32(d + HalfKPTransformerSize) != HalfKPNetworkHash) return false;
 
   return true;
 }
 
-static void init_weights(const void *evalData)
+static void halfkp_init_weights(const char *d)
 {
-  const char *d = (const char *)evalData + TransformerStart + 4;
+  NetWeights *w = &private_net;
 
   // Read transformer
+  d += 4;
   for (unsigned i = 0; i < kHalfDimensions; i++, d += 2)
-    ft_biases[i] = readu_le_u16(d);
+    w->ft_biases[i] = readu_le_u16(d);
   for (unsigned i = 0; i < kHalfDimensions * FtInDims; i++, d += 2)
-    ft_weights[i] = readu_le_u16(d);
+    w->ft_weights[i] = readu_le_u16(d);
 
   // Read network
   d += 4;
-  for (unsigned i = 0; i < 32; i++, d += 4)
-    hidden1_biases[i] = readu_le_u32(d);
-  d = read_hidden_weights(hidden1_weights, 512, d);
-  for (unsigned i = 0; i < 32; i++, d += 4)
-    hidden2_biases[i] = readu_le_u32(d);
-  d = read_hidden_weights(hidden2_weights, 32, d);
+  for (unsigned i = 0; i < L1Dims; i++, d += 4)
+    w->hidden1_biases[i] = readu_le_u32(d);
+  d = read_hidden_weights(w->hidden1_weights, FtOutDims, d);
+  for (unsigned i = 0; i < L2Dims; i++, d += 4)
+    w->hidden2_biases[i] = readu_le_u32(d);
+  d = read_hidden_weights(w->hidden2_weights, L1Dims, d);
   for (unsigned i = 0; i < 1; i++, d += 4)
-    output_biases[i] = readu_le_u32(d);
-  read_output_weights(output_weights, d);
+    w->output_biases[i] = readu_le_u32(d);
+  read_output_weights(w->output_weights, d);
 
 #ifdef USE_AVX2
-  permute_biases(hidden1_biases);
-  permute_biases(hidden2_biases);
+  permute_biases(w->hidden1_biases);
+  permute_biases(w->hidden2_biases);
 #endif
 }
 
+// A network architecture the engine can load: 'verify' checks the body of
+// the file (everything after the header and its description) and 'load'
+// reads it into 'private_net'. Supporting another architecture means adding
+// its feature set, its layers and an entry to this table.
+typedef struct {
+  const char *name;
+  uint32_t hash;
+  bool (*verify)(const char *d, size_t size);
+  void (*load)(const char *d);
+} NetArch;
+
+static const NetArch NetArchs[] = {
+  { "HalfKP(Friend)[41024->256x2]-32-32-1",
+    HalfKPTransformerHash ^ HalfKPNetworkHash,
+    halfkp_verify, halfkp_init_weights }
+};
+
+// Check the header of a network file and find its architecture. On success,
+// 'body' points to the beginning of the feature transformer.
+static const NetArch *verify_net(const void *evalData, size_t size,
+    const char **body)
+{
+  const char *d = (const char *)evalData;
+  if (size < 12 || readu_le_u32(d) != NnueVersion) return NULL;
+
+  uint32_t hash = readu_le_u32(d + 4);
+  size_t descLen = readu_le_u32(d + 8);
+  if (descLen > size - 12) return NULL;
+
+  *body = d + 12 + descLen;
+  for (unsigned i = 0; i < sizeof(NetArchs) / sizeof(NetArchs[0]); i++)
+    if (NetArchs[i].hash == hash)
+      return NetArchs[i].verify(*body, size - 12 - descLen) ? &NetArchs[i] : NULL;
+
+  printf("Unsupported network architecture: %.*s\n", (int)descLen, d + 12);
+  return NULL;
+}
+
+/*
+Weights cache
+*/
+
+// Name of the SIMD layout of the weights, which is part of the name of the
+// cache file, since builds for different architectures can't share it
+#if defined(USE_AVX512)
+#define NNUE_LAYOUT "avx512"
+#elif defined(USE_AVX2)
+#define NNUE_LAYOUT "avx2"
+#elif defined(USE_SSSE3)
+#define NNUE_LAYOUT "ssse3"
+#elif defined(USE_MMX) || defined(USE_SSE2)
+#define NNUE_LAYOUT "sse2"
+#else
+#define NNUE_LAYOUT "int8"
+#endif
+
+// The cache file is a copy of NetWeights (as laid out in memory) after this
+// header, which identifies the network file it was created from
+enum {
+  CacheMagic = 0x434e4e47 // "GNNC"
+};
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t weightsSize;
+  uint32_t layoutSize;
+  char layout[16];
+  uint64_t netSize;
+  uint64_t netTime;
+  char reserved[16];
+} CacheHeader;
+
+static_assert(sizeof(CacheHeader) == 64, "the weights must be 64-byte aligned in the cache file");
+
+// Network file loaded, and cache file mapped (if any)
+static char net_file[1024];
+static const void *cache_data = NULL;
+static map_t cache_mapping;
+
+static void cache_file_name(const char *evalFile, char *name, size_t size)
+{
+  snprintf(name, size, "%s.%s.cache", evalFile, NNUE_LAYOUT);
+}
+
+static void init_cache_header(const char *evalFile, CacheHeader *header)
+{
+  struct stat st;
+
+  memset(header, 0, sizeof(CacheHeader));
+  header->magic = CacheMagic;
+  header->version = NnueVersion;
+  header->weightsSize = sizeof(NetWeights);
+  header->layoutSize = sizeof(NNUE_LAYOUT);
+  strncpy(header->layout, NNUE_LAYOUT, sizeof(header->layout) - 1);
+
+  // a cache created from another network file (or from an older copy of
+  // the same file) is never used
+  if (stat(evalFile, &st) == 0) {
+    header->netSize = st.st_size;
+    header->netTime = st.st_mtime;
+  }
+}
+
+static void unmap_cache(void)
+{
+  if (cache_data) unmap_file(cache_data, cache_mapping);
+  cache_data = NULL;
+  net = &private_net;
+}
+
+static bool load_cache_file(const char *evalFile)
+{
+  char name[1100];
+  CacheHeader header;
+  const void *data;
+  map_t mapping;
+  size_t size;
+
+  cache_file_name(evalFile, name, sizeof(name));
+
+  {
+    FD fd = open_file(name);
+    if (fd == FD_ERR) return false;
+    size = file_size(fd);
+    data = size ? map_file(fd, &mapping) : NULL;
+    close_file(fd);
+  }
+
+  if (!data) return false;
+
+  init_cache_header(evalFile, &header);
+  if (   size != sizeof(CacheHeader) + sizeof(NetWeights)
+      || memcmp(data, &header, sizeof(CacheHeader))) {
+    unmap_file(data, mapping);
+    return false;
+  }
+
+  // use the weights right from the mapping, without any copy
+  unmap_cache();
+  cache_data = data;
+  cache_mapping = mapping;
+  net = (NetWeights *)((uintptr_t)data + sizeof(CacheHeader));
+  printf("Using neural network: %s (weights cache: %s)\n", evalFile, name);
+  return true;
+}
+
 static bool load_eval_file(const char *evalFile)
 {
   const void *evalData;
@@ -1255,29 +1456,120 @@ static bool load_eval_file(const char *evalFile)
     close_file(fd);
   }
 
-  bool success = verify_net(evalData, size);
+  const char *body;
+  const NetArch *arch = verify_net(evalData, size, &body);
+  bool success = arch != NULL;
   if (success)
   {
-    init_weights(evalData);
+    unmap_cache();
+    arch->load(body);
     printf("Using neural network: %s\n", evalFile);
   }
   if (mapping) unmap_file(evalData, mapping);
   return success;
 }
 
+/*
+Embedded network
+*/
+
+// With NNUE_EMBEDDED (make EMBED=yes), the network file it names is
+// assembled into the read-only data of the binary (see "incbin" in the
+// assembler manual), and it's used instead of the file of the same name
+#ifdef NNUE_EMBEDDED
+#if defined(__APPLE__)
+#define INCBIN_SECTION ".const_data\n"
+#define INCBIN_PREFIX "_"
+#elif defined(_WIN32)
+#define INCBIN_SECTION ".section .rdata, \"dr\"\n"
+#define INCBIN_PREFIX ""
+#else
+#define INCBIN_SECTION ".section .rodata\n"
+#define INCBIN_PREFIX ""
+#endif
+
+__asm__(INCBIN_SECTION
+        ".global " INCBIN_PREFIX "embedded_net_data\n"
+        ".balign 64\n"
+        INCBIN_PREFIX "embedded_net_data:\n"
+        ".incbin \"" NNUE_EMBEDDED "\"\n"
+        ".global " INCBIN_PREFIX "embedded_net_end\n"
+        INCBIN_PREFIX "embedded_net_end:\n"
+        ".byte 0\n"
+        ".text\n");
+
+extern "C" const char embedded_net_data[];
+extern "C" const char embedded_net_end[];
+
+static bool load_embedded_net(void)
+{
+  size_t size = embedded_net_end - embedded_net_data;
+
+  const char *body;
+  const NetArch *arch = verify_net(embedded_net_data, size, &body);
+  bool success = arch != NULL;
+  if (success)
+  {
+    unmap_cache();
+    arch->load(body);
+    printf("Using neural network: %s (embedded)\n", NNUE_EMBEDDED);
+  }
+  return success;
+}
+#endif
+
 /*
 Interfaces
 */
-DLLExport void _CDECL nnue_init(const char* evalFile)
+DLLExport int _CDECL nnue_init(const char* evalFile)
 {
+  bool success = false;
+
   fflush(stdout);
 
-  if (load_eval_file(evalFile)) {
-    fflush(stdout);
-    return;
+#ifdef NNUE_EMBEDDED
+  if (!strcmp(evalFile, NNUE_EMBEDDED))
+    success = load_embedded_net();
+#endif
+
+  if (!success)
+    success = load_cache_file(evalFile) || load_eval_file(evalFile);
+
+  if (success)
+    snprintf(net_file, sizeof(net_file), "%s", evalFile);
+
+  fflush(stdout);
+  return success;
+}
+
+DLLExport int _CDECL nnue_write_cache(void)
+{
+  char name[1100], temp[1200];
+  CacheHeader header;
+
+  if (!net_file[0]) return 0;
+
+  cache_file_name(net_file, name, sizeof(name));
+  snprintf(temp, sizeof(temp), "%s.tmp", name);
+  init_cache_header(net_file, &header);
+
+  // write a temporary file first, so that other processes never map a
+  // cache file partially written
+  FILE *f = fopen(temp, "wb");
+  if (!f) return 0;
+
+  bool success =    fwrite(&header, sizeof(CacheHeader), 1, f) == 1
+                 && fwrite(net, sizeof(NetWeights), 1, f) == 1;
+  success = (fclose(f) == 0) && success;
+
+  if (!success || rename(temp, name)) {
+    remove(temp);
+    return 0;
   }
 
+  printf("Weights cache written: %s\n", name);
   fflush(stdout);
+  return 1;
 }
 
 DLLExport int _CDECL nnue_evaluate(
@@ -1311,6 +1603,22 @@ DLLExport int _CDECL nnue_evaluate_incremental(
   return nnue_evaluate_pos(&pos);
 }
 
+DLLExport void _CDECL nnue_update_accumulator(
+  int* pieces, int* squares, NNUEdata** nnue)
+{
+  assert(nnue[0] && (uint64_t)(&nnue[0]->accumulator) % 64 == 0);
+
+  Position pos;
+  pos.nnue[0] = nnue[0];
+  pos.nnue[1] = nnue[1];
+  pos.nnue[2] = nnue[2];
+  pos.player = 0;
+  pos.pieces = pieces;
+  pos.squares = squares;
+  if (!update_accumulator(&pos))
+    refresh_accumulator(&pos);
+}
+
 DLLExport int _CDECL nnue_evaluate_fen(const char* fen)
 {
   int pieces[33],squares[33],player,castle,fifty,move_number;
@@ -55,8 +55,11 @@ typedef struct DirtyPiece {
   int to[3];
 } DirtyPiece;
 
+// Number of outputs of each half (perspective) of the feature transformer
+#define NNUE_HALF_DIMENSIONS 256
+
 typedef struct Accumulator {
-  alignas(64) int16_t accumulation[2][256];
+  alignas(64) int16_t accumulation[2][NNUE_HALF_DIMENSIONS];
   int computedAccumulation;
 } Accumulator;
 
@@ -96,12 +99,24 @@ int nnue_evaluate_pos(Position* pos);
 **************************************************************************/
 
 /**
-* Load NNUE file
+* Load NNUE file (or the network embedded in the binary, if the file name
+* is the one of the embedded network)
+* Returns
+*   1 on success, 0 otherwise (the network loaded before, if any, is kept)
 */
-DLLExport void _CDECL nnue_init(
+DLLExport int _CDECL nnue_init(
   const char * evalFile             /** Path to NNUE file */
 );
 
+/**
+* Write the weights of the network loaded, in the layout used by this build,
+* to a cache file next to the network file (<file>.<layout>.cache), which
+* nnue_init() maps read-only instead of reading the network file afterwards
+* Returns
+*   1 on success, 0 otherwise
+*/
+DLLExport int _CDECL nnue_write_cache(void);
+
 /**
 * Evaluate on FEN string
 * Returns
@@ -152,4 +167,16 @@ DLLExport int _CDECL nnue_evaluate_incremental(
   NNUEdata** nnue_data              /** Pointer to NNUEdata* for current and previous plies */
 );
 
+/**
+* Update the accumulator of the current ply only, as in
+* @nnue_evaluate_incremental, without evaluating the network. This keeps the
+* accumulators of the next plies incremental when the score of the position
+* is known already (e.g., from an evaluation cache).
+*/
+DLLExport void _CDECL nnue_update_accumulator(
+  int* pieces,                      /** Array of pieces */
+  int* squares,                     /** Corresponding array of squares each piece stands on */
+  NNUEdata** nnue_data              /** Pointer to NNUEdata* for current and previous plies */
+);
+
 #endif
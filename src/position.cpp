@@ -27,6 +27,8 @@
 #include "bitboard.h"
 #include "position.h"
 #include "tt.h"
+#include "eval.h"
+#include "movgen.h"
 #include "search.h"
 
 
@@ -35,72 +37,56 @@ using namespace std;
 
 
 
-// A position is defined by the following elements:
-//
-// 1. A set of 12 bitboards with all the piece occupancies
-// 2. The side to move
-// 3. The enpassant capture square
-// 4. The castling rights
-// 5. The 50-move rule (50 moves without captures, pawn moves nor promotions)
-// 6. A ply counter (to separate root moves from the rest)
-Bitboard bitboards[12];
-Bitboard occupancies[3];
-int sideToMove = White;
-int epsq = NoSq; 
-int castle;
-int fifty = 0;
-int ply = 0;
-
-
-
-// Chess position's (almost) unique hash key
-uint64_t hash_key = 0ULL;
-
-
-
 // Flag to indicate whether the board should be displayed from White's
 // perspective (false) or Black's perspective (true).
 bool flip = false;
 
 
 
-// Structures to detect 3-fold repetitions within the game:
-Bitboard repetition_table[1024];
-int repetition_index;
-
-
-
 // resetBoard
 //
 // Reset the board variables, set the pieces back to start position, etc.
-void resetBoard()
+void resetBoard(Position_t &pos)
 {
     // reset board position and occupancies
-    memset(bitboards, 0ULL, sizeof(bitboards));
-    memset(occupancies, 0ULL, sizeof(occupancies));
+    memset(pos.bitboards, 0ULL, sizeof(pos.bitboards));
+    memset(pos.occupancies, 0ULL, sizeof(pos.occupancies));
+
+
+    // empty the mailbox and the piece list (the first two entries of the
+    // piece list are always reserved for the Kings)
+    for (int sq = 0; sq < 64; sq++)
+        pos.board[sq] = NoPiece;
+
+    memset(pos.pieceIndex, 0, sizeof(pos.pieceIndex));
+    memset(pos.nnuePieces, 0, sizeof(pos.nnuePieces));
+    memset(pos.nnueSquares, 0, sizeof(pos.nnueSquares));
+    pos.pieceCount = 2;
 
     
     // reset game state variables
-    sideToMove = White;
-    epsq       = NoSq;
-    castle     = 0;
-    flip       = false;
+    pos.sideToMove = White;
+    pos.epsq       = NoSq;
+    pos.castle     = 0;
+    pos.ply        = 0;
+    flip           = false;
    
 
-    // reset repetition index
-    repetition_index = 0;
+    // empty the undo stack, which also holds the positions used to detect
+    // 3-fold repetitions
+    pos.gamePly = 0;
 
 
     // reset hash_key
-    hash_key = 0ULL;
+    pos.hash_key = 0ULL;
 
 
     // reset fifty move rule counter
-    fifty = 0;
+    pos.fifty = 0;
 
 
-    // reset repetition table
-    memset(repetition_table, 0ULL, sizeof(repetition_table));
+    // the root accumulator does not match the new position anymore
+    resetAccumulator(pos.nnue[0]);
 }
 
 
@@ -113,7 +99,7 @@ void resetBoard()
 // this is assumed to be the responsibility of the GUI.
 //
 // @see https://github.com/official-stockfish/Stockfish/blob/master/src/position.cpp
-void setPosition(const string &fenStr)
+void setPosition(Position_t &pos, const string &fenStr)
 {
 /*
     A FEN string defines a particular position using only the ASCII character set.
@@ -158,7 +144,7 @@ void setPosition(const string &fenStr)
 
 
     // reset board status
-    resetBoard();
+    resetBoard(pos);
 
 
     // 1. Piece placement
@@ -179,7 +165,8 @@ void setPosition(const string &fenStr)
         else if ((it = PieceConst.find(token)) != PieceConst.end())
         {
             sq = rank * 8 + file;
-            setBit(bitboards[PieceConst[token]], sq);
+            putPiece(pos, PieceConst[token], sq);
+            pos.hash_key ^= piece_keys[PieceConst[token]][sq];
             sq++;
             file++;
         }
@@ -188,7 +175,10 @@ void setPosition(const string &fenStr)
 
     // 2. Side to move
     ss >> token;
-    sideToMove = (token == 'w' ? White : Black);
+    pos.sideToMove = (token == 'w' ? White : Black);
+
+    if (pos.sideToMove == Black)
+        pos.hash_key ^= side_key;
     ss >> token;
 
 
@@ -197,58 +187,51 @@ void setPosition(const string &fenStr)
     {
         switch (token)
         {
-            case 'K': castle |= wk; break;
-            case 'Q': castle |= wq; break;
-            case 'k': castle |= bk; break;
-            case 'q': castle |= bq; break;
+            case 'K': pos.castle |= wk; break;
+            case 'Q': pos.castle |= wq; break;
+            case 'k': pos.castle |= bk; break;
+            case 'q': pos.castle |= bq; break;
             case '-': break;
         }
     }
 
+    pos.hash_key ^= castle_keys[pos.castle];
+
 
     // 4. Enpassant square
     // Ignore if square is invalid or not on side to move relative rank 6.
     if (   ((ss >> col) && (col >= 'a' && col <= 'h'))
-        && ((ss >> row) && (row == (sideToMove == White ? '6' : '3'))))
+        && ((ss >> row) && (row == (pos.sideToMove == White ? '6' : '3'))))
     {
         // parse enpassant file & rank
         int file = col - 'a';
         int rank = 8 - (row - '0');
 
         // set enpassant only if sideToMove matches enpanssant square
-        if (   ((sideToMove == White) && (rank == 2))
-            || ((sideToMove == Black) && (rank == 5)))
+        if (   ((pos.sideToMove == White) && (rank == 2))
+            || ((pos.sideToMove == Black) && (rank == 5)))
         {
-            epsq = rank * 8 + file;
+            pos.epsq = rank * 8 + file;
+            pos.hash_key ^= enpassant_keys[pos.epsq];
         }
     }
     else
     {
-        epsq = NoSq;
+        pos.epsq = NoSq;
     }
 
 
     // 5-6. Halfmove clock and fullmove number
-    ss >> skipws >> fifty;
+    ss >> skipws >> pos.fifty;
 
 
-    // populate white occupancy bitboard
-    for (int piece = P; piece <= K; piece++)
-        occupancies[White] |= bitboards[piece];
-   
-
-    // populate white occupancy bitboard
-    for (int piece = p; piece <= k; piece++)
-        occupancies[Black] |= bitboards[piece];
-   
-
-    // init all occupancies
-    occupancies[Both] |= occupancies[White];
-    occupancies[Both] |= occupancies[Black];
+    // init all occupancies (White and Black are set while placing the pieces)
+    pos.occupancies[Both] = pos.occupancies[White] | pos.occupancies[Black];
    
 
-    // init hash key
-    hash_key = generateHashkey();
+    // the hash key has been built along with the position, the full
+    // computation is only used to validate it
+    assert(pos.hash_key == generateHashkey(pos));
 }
 
 
@@ -256,7 +239,7 @@ void setPosition(const string &fenStr)
 // getFEN
 //
 // Return a FEN representation of the current position.
-string getFEN()
+string getFEN(Position_t &pos)
 {
     int emptyCnt = 0;
     int fromSq, rank, file;
@@ -277,34 +260,34 @@ string getFEN()
 
 
     // serialize all pieces into a board structure
-    Bitboard bb = occupancies[Both];
+    Bitboard bb = pos.occupancies[Both];
     while (bb)
     {
         fromSq = popLsb(bb);
 
-        if (SqBB[fromSq] & bitboards[P])
+        if (SqBB[fromSq] & pos.bitboards[P])
             board[fromSq % 8][fromSq / 8] = P;
-        else if (SqBB[fromSq] & bitboards[N])
+        else if (SqBB[fromSq] & pos.bitboards[N])
             board[fromSq % 8][fromSq / 8] = N;
-        else if (SqBB[fromSq] & bitboards[B])
+        else if (SqBB[fromSq] & pos.bitboards[B])
             board[fromSq % 8][fromSq / 8] = B;
-        else if (SqBB[fromSq] & bitboards[R])
+        else if (SqBB[fromSq] & pos.bitboards[R])
             board[fromSq % 8][fromSq / 8] = R;
-        else if (SqBB[fromSq] & bitboards[Q])
+        else if (SqBB[fromSq] & pos.bitboards[Q])
             board[fromSq % 8][fromSq / 8] = Q;
-        else if (SqBB[fromSq] & bitboards[K])
+        else if (SqBB[fromSq] & pos.bitboards[K])
             board[fromSq % 8][fromSq / 8] = K;
-        else if (SqBB[fromSq] & bitboards[p])
+        else if (SqBB[fromSq] & pos.bitboards[p])
             board[fromSq % 8][fromSq / 8] = p;
-        else if (SqBB[fromSq] & bitboards[n])
+        else if (SqBB[fromSq] & pos.bitboards[n])
             board[fromSq % 8][fromSq / 8] = n;
-        else if (SqBB[fromSq] & bitboards[b])
+        else if (SqBB[fromSq] & pos.bitboards[b])
             board[fromSq % 8][fromSq / 8] = b;
-        else if (SqBB[fromSq] & bitboards[r])
+        else if (SqBB[fromSq] & pos.bitboards[r])
             board[fromSq % 8][fromSq / 8] = r;
-        else if (SqBB[fromSq] & bitboards[q])
+        else if (SqBB[fromSq] & pos.bitboards[q])
             board[fromSq % 8][fromSq / 8] = q;
-        else if (SqBB[fromSq] & bitboards[k])
+        else if (SqBB[fromSq] & pos.bitboards[k])
             board[fromSq % 8][fromSq / 8] = k;
     }
 
@@ -330,43 +313,43 @@ string getFEN()
 
 
     // side to move
-    ss << (sideToMove == White ? " w " : " b ");
+    ss << (pos.sideToMove == White ? " w " : " b ");
 
 
     // castling rights
-    if (castle & wk)
+    if (pos.castle & wk)
         ss << 'K';
 
-    if (castle & wq)
+    if (pos.castle & wq)
         ss << 'Q';
 
-    if (castle & bk)
+    if (pos.castle & bk)
         ss << 'k';
 
-    if (castle & bq)
+    if (pos.castle & bq)
         ss << 'q';
 
-    if (!castle)
+    if (!pos.castle)
         ss << '-';
 
     ss << " ";
 
 
     // enpassant square
-    if (epsq && (epsq == NoSq))
+    if (pos.epsq && (pos.epsq == NoSq))
         ss << "-";
     else
-        ss << SquareToCoordinates[epsq];
+        ss << SquareToCoordinates[pos.epsq];
 
     ss << " ";
 
 
     // fifty rule
-    ss << fifty << " ";
+    ss << pos.fifty << " ";
 
 
     // ply
-    ss << 1 + (ply - (sideToMove == Black)) / 2;
+    ss << 1 + (pos.ply - (pos.sideToMove == Black)) / 2;
 
 
     // return FEN string
@@ -380,7 +363,7 @@ string getFEN()
 // Convert the internal representation of the board into a human-readable string
 // (capable of being shown and represented as a Board in ASCII) and show it on
 // the screen.
-void printBoard()
+void printBoard(Position_t &pos)
 {
     cout << endl << endl;
     cout << "    +----+----+----+----+----+----+----+----+" << endl;
@@ -414,7 +397,7 @@ void printBoard()
             Side color = NoColor;
             for (int bb_piece = P; bb_piece <= k; bb_piece++)
             {
-                if (getBit(bitboards[bb_piece], square))
+                if (getBit(pos.bitboards[bb_piece], square))
                     piece = bb_piece;
 
                 switch (piece)
@@ -447,14 +430,14 @@ void printBoard()
 
 
     // print board status
-    cout << "  Fen:    " << getFEN() << endl;
-    cout << "  Key:    " << hex << uppercase << hash_key << endl;
-    cout << "  Side:   " << ((sideToMove == White) ? "White" : "Black") << endl;
-    cout << "  Epsq:   " << ((epsq != NoSq) ? SquareToCoordinates[epsq] : "-") << endl;
-    cout << "  Castle: " << ((castle & wk) ? "K" : "-") <<
-                            ((castle & wq) ? "Q" : "-") <<
-                            ((castle & bk) ? "k" : "-") <<
-                            ((castle & bq) ? "q" : "-") << endl;
+    cout << "  Fen:    " << getFEN(pos) << endl;
+    cout << "  Key:    " << hex << uppercase << pos.hash_key << endl;
+    cout << "  Side:   " << ((pos.sideToMove == White) ? "White" : "Black") << endl;
+    cout << "  Epsq:   " << ((pos.epsq != NoSq) ? SquareToCoordinates[pos.epsq] : "-") << endl;
+    cout << "  Castle: " << ((pos.castle & wk) ? "K" : "-") <<
+                            ((pos.castle & wq) ? "Q" : "-") <<
+                            ((pos.castle & bk) ? "k" : "-") <<
+                            ((pos.castle & bq) ? "q" : "-") << endl;
 
     // reset formating for the next time
     cout << resetiosflags(std::cout.flags());
@@ -25,6 +25,8 @@
 #include <map>
 #include <cstring>
 
+#include "nnue.h"
+
 
 
 // List of useful FEN positions used for testing and debbuging purposes
@@ -103,31 +105,14 @@ static std::map<int, unsigned char> PromoPieces = {
 
 
 
-// A chess position is defined by the following elements:
-//
-// 1. A set of 12 bitboards with all the piece occupancies
-// 2. The side to move
-// 3. The enpassant capture square
-// 4. The castling rights
-// 5. The 50-move rule counter
-extern Bitboard bitboards[12];
-extern Bitboard occupancies[3];
-extern int sideToMove;
-extern int epsq;
-extern int castle;
-extern int fifty;
-extern int ply;
-
-
-
-// Every chess position has its own (almost) unique hash key:
-extern uint64_t hash_key;
+// Maximum depth at which we try to search
+#define MaxPly            256
 
 
 
-// Flag to indicate whether the board should be displayed from White's
-// perspective (false) or Black's perspective (true).
-extern bool flip;
+// Maximum number of moves (plies) that can be played in a game, including
+// the moves made by the search on top of the moves sent by the GUI
+#define MaxGamePly        2048
 
 
 
@@ -151,38 +136,108 @@ enum castling { wk = 1, wq = 2, bk = 4, bq = 8 };
 
 
 
-// Structures to detect 3-fold repetitions within the game:
+// StateInfo_t is the record pushed on the undo stack of a position every
+// time a move is made. It holds everything that cannot be recomputed from
+// the move itself when the move is taken back:
+//
+// move       the move made (0 for a null move)
+// captured   the piece captured by the move (NoPiece if none)
+// castle     castling rights before the move
+// epsq       enpassant square before the move
+// fifty      50-move rule counter before the move
+// hash_key   hash key of the position before the move, which is also used
+//            to detect 3-fold repetitions
+typedef struct
+{
+    int      move;
+    int      captured;
+    int      castle;
+    int      epsq;
+    int      fifty;
+    uint64_t hash_key;
+} StateInfo_t;
+
+
+
+// A chess position is defined by the following elements:
+//
+// 1. A set of 12 bitboards with all the piece occupancies
+// 2. The side to move
+// 3. The enpassant capture square
+// 4. The castling rights
+// 5. The 50-move rule counter
+// 6. A ply counter (distance to the root of the search)
+// 7. Its (almost) unique hash key
+//
+// On top of that, every position carries its own undo stack (states), with
+// one StateInfo_t per move played since the position was set up, and the
+// stack of NNUE accumulators indexed by ply. This makes a position fully
+// self-contained, so that each search thread can work on its own copy.
 //
-// repetition_table stores a number of positions "played" during the search
-// repetition_index tells the size of the repetition_table (pointer to last)
-extern Bitboard repetition_table[1024];
-extern int repetition_index;
+// The pieces are also kept redundantly in a mailbox (board), which tells the
+// piece standing on a square with a single lookup, and in a piece list ready
+// to be fed to the NNUE (nnuePieces and nnueSquares, using NNUE codes, with
+// the White King at index 0, the Black King at index 1 and a terminating 0
+// after the last piece). pieceIndex tells where every piece is in that list.
+typedef struct
+{
+    Bitboard    bitboards[12];
+    Bitboard    occupancies[3];
+    int         board[64];
+    int         pieceIndex[64];
+    int         nnuePieces[33];
+    int         nnueSquares[33];
+    int         pieceCount;
+    int         sideToMove;
+    int         epsq;
+    int         castle;
+    int         fifty;
+    int         ply;
+    uint64_t    hash_key;
+    int         gamePly;
+    StateInfo_t states[MaxGamePly];
+    NNUEdata    nnue[MaxPly + 1];
+} Position_t;
+
+
+
+// Flag to indicate whether the board should be displayed from White's
+// perspective (false) or Black's perspective (true).
+extern bool flip;
 
 
 
 // Functionality to handle a position on the chess board, including
 // resting the board to its initial status, printing the board and
 // parsing positions in FEN notation.
-void resetBoard();
-void printBoard();
-void setPosition(const std::string &);
-std::string getFEN();
+void resetBoard(Position_t &);
+void printBoard(Position_t &);
+void setPosition(Position_t &, const std::string &);
+std::string getFEN(Position_t &);
 
 
 
 // isRepetition
 //
-// Counts the 3-fold repetitions played on the board. Returns the number
-// of repetitions, i.e., a return value >= 3 means it's a draw.
-static inline int isRepetition()
+// Tell whether the current position has been played before, since the
+// position was set up (note that a single repetition counts as a draw).
+// This is called at the root too (ply 0), e.g. by TB::filterRootMoves().
+//
+// Only the positions since the last irreversible move (capture or pawn move)
+// can be repeated, i.e., the last 'fifty' plies at most, since makeMove()
+// resets the counter on both, and only every second one of them has the
+// same side to move.
+static inline int isRepetition(Position_t &pos)
 {
     // reliability checks
-    assert(ply > 0);
+    assert(pos.ply >= 0);
+
 
+    // look for the current hash key among the positions in the undo stack
+    int last = (pos.fifty < pos.gamePly) ? pos.fifty : pos.gamePly;
 
-    // if we found the hash key same with a current
-    for (int index = repetition_index; index > 0; index--)
-        if (repetition_table[index] == hash_key)
+    for (int distance = 2; distance <= last; distance += 2)
+        if (pos.states[pos.gamePly - distance].hash_key == pos.hash_key)
             return true;
    
 
@@ -203,24 +258,24 @@ static inline int isRepetition()
 // 3.4 Kminor-Kminor ending 
 // 3.5 KB-KB ending (all bishops on same-color squares)
 // 3.6 KBN-Kminor
-static inline bool isDraw()
+static inline bool isDraw(Position_t &pos)
 {
     // 50-move rule
-    if (fifty > 99)
+    if (pos.fifty > 99)
         return true;
 
 
     // 3-fold repetition
-    if (isRepetition())
+    if (isRepetition(pos))
         return true;
 
 
     // calculate the number of pieces on the board
-    int total_pieces  = countBits(occupancies[Both]);
-    int white_knights = countBits(bitboards[N]);
-    int black_knights = countBits(bitboards[n]);
-    int white_bishops = countBits(bitboards[B]);
-    int black_bishops = countBits(bitboards[b]);
+    int total_pieces  = countBits(pos.occupancies[Both]);
+    int white_knights = countBits(pos.bitboards[N]);
+    int black_knights = countBits(pos.bitboards[n]);
+    int white_bishops = countBits(pos.bitboards[B]);
+    int black_bishops = countBits(pos.bitboards[b]);
 
     
     // K-K ending
@@ -253,11 +308,11 @@ static inline bool isDraw()
 
 
     // KB-KB ending (all bishops on same-color squares)
-    if (((bitboards[B] | bitboards[b]) & LightSquares) ||
-        ((bitboards[B] | bitboards[b]) & DarkSquares))
+    if (((pos.bitboards[B] | pos.bitboards[b]) & LightSquares) ||
+        ((pos.bitboards[B] | pos.bitboards[b]) & DarkSquares))
     {
-        if ((bitboards[N] | bitboards[R] | bitboards[Q] | bitboards[P] |
-             bitboards[n] | bitboards[r] | bitboards[q] | bitboards[p]) == 0)
+        if ((pos.bitboards[N] | pos.bitboards[R] | pos.bitboards[Q] | pos.bitboards[P] |
+             pos.bitboards[n] | pos.bitboards[r] | pos.bitboards[q] | pos.bitboards[p]) == 0)
         {
             return true;
         }
@@ -271,15 +326,15 @@ static inline bool isDraw()
         // Strong bishop pair vs. Knight is not a draw
         if (white_bishops == 2)
         {
-            if (((bitboards[B] & LightSquares) != bitboards[B]) &&
-                (((bitboards[B] & DarkSquares) != bitboards[B])))
+            if (((pos.bitboards[B] & LightSquares) != pos.bitboards[B]) &&
+                (((pos.bitboards[B] & DarkSquares) != pos.bitboards[B])))
             return false;
         }
 
         if (black_bishops == 2)
         {
-            if (((bitboards[b] & LightSquares) != bitboards[b]) &&
-                (((bitboards[b] & DarkSquares) != bitboards[b])))
+            if (((pos.bitboards[b] & LightSquares) != pos.bitboards[b]) &&
+                (((pos.bitboards[b] & DarkSquares) != pos.bitboards[b])))
             return false;
         }
 
@@ -299,9 +354,9 @@ static inline bool isDraw()
 // noMajorsOrMinors
 //
 // Return true if there are no major nor minor pieces left on the board.
-static inline bool noMajorsOrMinors()
+static inline bool noMajorsOrMinors(Position_t &pos)
 {
-    return !(countBits(occupancies[Both]) - countBits(bitboards[P]) - countBits(bitboards[p]) - 2);
+    return !(countBits(pos.occupancies[Both]) - countBits(pos.bitboards[P]) - countBits(pos.bitboards[p]) - 2);
 }
 
 
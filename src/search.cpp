@@ -22,16 +22,29 @@
 #include <iomanip>
 #include <chrono>
 #include <cassert>
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 #include "search.h"
+#include "movepick.h"
 #include "eval.h"
+#include "tb.h"
+#include "stats.h"
+#include "timeman.h"
 
 
 
 // 'nodes' is a global variable holding the number of nodes analyzed
 // or searched. It is used by negamax() but also other performance test
-// functions such as perft().
-uint64_t nodes = 0ULL;
+// functions such as perft(). Every search thread has its own counter.
+thread_local atomic<uint64_t> nodes(0ULL);
+
+
+
+// 'tbhits' is the number of positions found in the tablebases (syzygy) by
+// each search thread.
+thread_local atomic<uint64_t> tbhits(0ULL);
 
 
 
@@ -46,12 +59,34 @@ std::map<string, int> Options;
 
 
 
+// perft hash table, disabled by default
+PerftEntry_t *perft_table      = nullptr;
+uint64_t      perft_table_mask = 0ULL;
+
+
+
 // Time Control variables
-uint64_t starttime = getTimeInMilliseconds();
-uint64_t stoptime  = starttime;
-uint64_t inc       = 0;
-bool     timedout  = false;
-bool     timeset   = true;
+uint64_t     starttime = getTimeInMilliseconds();
+uint64_t     stoptime  = starttime;
+atomic<bool> timedout(false);
+atomic<bool> pondering(false);
+atomic<bool> stopOnPonderhit(false);
+bool         timeset   = true;
+
+
+
+// The thread running search() (i.e., not a helper thread) is the one in
+// charge of checking the time and nodes limits
+static thread_local bool isMainThread = false;
+
+
+
+// PV lines searched at the root (MultiPV), best line first, and the root moves
+// that are excluded from the search of the current line (i.e., the moves of
+// the lines searched before). These are only used by the main search thread.
+static RootLine_t rootLines[OptionsMultiPVMax];
+static thread_local int excludedMoves[OptionsMultiPVMax];
+static thread_local int excludedCount = 0;
 
 
 
@@ -63,33 +98,32 @@ bool     timeset   = true;
 // beta cut-offs, where a move killer moves [id][ply]
 //
 // Note: storing exactly 2 killer moves is best for efficiency/performance.
-int killers[2][MaxPly];
+thread_local int killers[2][MaxPly];
 
 
 
 // history heuristics [piece][square]
-int history[12][64];
+thread_local int history[12][64];
 
 
 
 // PV length [ply]
-int pv_length[MaxPly];
+thread_local int pv_length[MaxPly];
 
 
 
 // PV table [ply][ply]
-int pv_table[MaxPly][MaxPly];
+thread_local int pv_table[MaxPly][MaxPly];
 
 
 
-// follow PV & score PV move
-bool followPV  = false;
-bool scorePV   = false;
+// follow PV
+thread_local bool followPV  = false;
 
 
 
 // allow Null move pruning
-bool allowNull = true;
+thread_local bool allowNull = true;
 
 
 
@@ -129,7 +163,7 @@ void resetLimits()
     Limits.binc      =  0;
     Limits.npmsec    =  0;
     Limits.movetime  =  0;
-    Limits.movestogo = 30;
+    Limits.movestogo =  0;
     Limits.depth     = MaxSearchDepth;
     Limits.mate      =  0;
     Limits.perft     =  0;
@@ -140,12 +174,148 @@ void resetLimits()
 
 
 
+// resetSearchData
+//
+// Reset the search stacks of the current thread before a new search.
+static void resetSearchData()
+{
+    // reset data structures for a new search
+    memset(killers, 0, sizeof(killers));
+    memset(history, 0, sizeof(history));
+    memset(pv_table, 0, sizeof(pv_table));
+    memset(pv_length, 0, sizeof(pv_length));
+
+
+    // reset follow PV flag
+    followPV   = false;
+    allowNull  = true;
+
+
+    // reset nodes counter
+    nodes.store(0ULL, memory_order_relaxed);
+    tbhits.store(0ULL, memory_order_relaxed);
+}
+
+
+
+// isExcludedMove
+//
+// Tell whether a root move belongs to one of the PV lines searched before the
+// current one, in the current iteration (MultiPV).
+static inline bool isExcludedMove(int move)
+{
+    for (int i = 0; i < excludedCount; i++)
+        if (excludedMoves[i] == move)
+            return true;
+
+    return false;
+}
+
+
+
+// countRootMoves
+//
+// Return the number of legal moves that can be searched at the root, i.e.,
+// preserving the tablebase result (if any).
+static int countRootMoves(Position_t &pos)
+{
+    MoveList_t MoveList;
+    int count = 0;
+
+
+    generateMoves(pos, MoveList);
+
+    for (int i = 0; i < MoveList.count; i++)
+        if (TB::isRootMove(MoveList.moves[i]))
+            count++;
+
+
+    return count;
+}
+
+
+
+// Buffer where the main thread builds its output lines, which are then sent
+// to the writer thread at once (see Threads::send()).
+static string output;
+
+
+
+// printLine
+//
+// Print the "info" line of a PV line of the root at the given depth, with the
+// search information of all the threads. The MultiPV index is only printed
+// when there's more than one line (i.e., 'multipv' is not 0).
+static void printLine(RootLine_t &line, int depth, int multipv, int64_t ms, int64_t ns)
+{
+    if (!line.length)
+        return;
+
+
+    output.clear();
+    output += "info depth " + to_string(depth);
+
+    if (multipv)
+        output += " multipv " + to_string(multipv);
+
+    // report mating distance if available, otherwise print score
+    if ((line.score > -MateValue) && (line.score < -MateScore))
+        output += " score mate " + to_string(-(line.score + MateValue) / 2 - 1);
+    else if ((line.score > MateScore) && (line.score < MateValue))
+        output += " score mate " + to_string((MateValue - line.score) / 2 + 1);
+    else
+        output += " score cp " + to_string(line.score);
+
+    // other search information: nodes (of all threads), nps, time, etc.
+    uint64_t total_nodes = Threads::nodes();
+    output += " nodes "    + to_string(total_nodes);
+    output += " nps "      + to_string(total_nodes * 1000000000 / std::max<int64_t>(ns, 1));
+    output += " hashfull " + to_string(TT::hashfull());
+    output += " tbhits "   + to_string(Threads::tbhits());
+    output += " time "     + to_string(ms);
+    output += " pv ";
+
+    // print PV line
+    for (int count = 0; count < line.length; count++)
+        output += prettyMove(line.pv[count]) + " ";
+
+
+    // new line before next depth
+    output += "\n";
+    Threads::send(output);
+}
+
+
+
+// checkLimits
+//
+// Stop the search when the time is up, or when the nodes limit is reached.
+// This is called by the main search thread at every node (before counting
+// it), but the clock is only read every CheckInterval nodes. The nodes limit
+// of a single thread is checked at every node, on its own counter, so that
+// "go nodes" stops at the exact node count; with more threads, the counters
+// of all of them are only added up every CheckInterval nodes.
+static inline void checkLimits()
+{
+    uint64_t n = nodes.load(memory_order_relaxed);
+    bool check = !(n & (CheckInterval - 1));
+
+    if (Limits.nodes && ((Threads::count() == 1) ? (n >= Limits.nodes)
+                                                 : (check && (Threads::nodes() >= Limits.nodes))))
+        timedout = true;
+
+    else if (timeset && !pondering && check && (getTimeInMilliseconds() >= stoptime))
+        timedout = true;
+}
+
+
+
 // negamax
 //
 // Main alphabeta algorithm (Negamax) which relies on a Principal Variation
 // search.
 //
-int negamax(int alpha, int beta, int depth)
+int negamax(Position_t &pos, int alpha, int beta, int depth)
 {
     // reliability checks
     assert(depth >= 0);
@@ -156,13 +326,17 @@ int negamax(int alpha, int beta, int depth)
     int score = 0, StaticEval = 0, EvalMargin = 0;
 
 
+    // raw NNUE score of the position, when it's known (see evaluateNNUE())
+    int nnueEval = EvalNone;
+
+
     // best move (to use with the transposition table)
     int bestmove = 0;
 
 
     // if the position is a draw, don't search anymore
-    if (ply && isDraw())
-        return contempt();
+    if (pos.ply && isDraw(pos))
+        return contempt(pos);
 
 
     // initialize hash flag for the transposition table
@@ -191,8 +365,8 @@ int negamax(int alpha, int beta, int depth)
     //
     // @see https://www.chessprogramming.org/Mate_Distance_Pruning
 
-    alpha = std::max(mated_in(ply), alpha);
-    beta  = std::min(mate_in(ply+1), beta);
+    alpha = std::max(mated_in(pos.ply), alpha);
+    beta  = std::min(mate_in(pos.ply+1), beta);
     if (alpha >= beta)
         return alpha;
 
@@ -211,9 +385,12 @@ int negamax(int alpha, int beta, int depth)
     //
     // @see https://www.chessprogramming.org/Transposition_Table
 
-    if (ply && ((score = TT::probe(alpha, beta, bestmove, depth)) != no_hash_found) && !pv_node)
-        if (fifty < 90)
+    if (pos.ply && ((score = TT::probe(pos, alpha, beta, bestmove, depth, nnueEval)) != no_hash_found) && !pv_node)
+        if (pos.fifty < 90)
+        {
+            STAT_INC(StatTTCutoffs);
             return score;
+        }
 
 
 
@@ -221,18 +398,21 @@ int negamax(int alpha, int beta, int depth)
     //
     // Step 3. Tablebases probe
     //
-    // If we have five (5) pieces left, including the kings, try to find the 
-    // position from the tablebases (syzygy), so no more search is needed.
+    // If there are few enough pieces left, including the kings, try to find
+    // the position in the tablebases (syzygy), so no more search is needed.
+    // The WDL tables are only probed right after a capture or a pawn move,
+    // since they don't know about the 50-move rule counter.
+    //
+    // The result is stored in the TT, so that further visits to the same
+    // position don't need to probe the tablebases again.
+    //
+    // @see https://www.chessprogramming.org/Syzygy_Bases
 
-    if (ply && (countBits(occupancies[Both]) <= 5) && (fifty == 0) && !castle)
+    if (pos.ply && (pos.fifty == 0) && TB::canProbe(pos) && TB::probeWDL(pos, score))
     {
-        /*
-        int wdl_score = TB::wdl_probe();
-
-        return (wdl_score < -DrawScore ? MateValue + ply + 1
-              : wdl_score >  DrawScore ? MateValue - ply - 1
-              : DrawScore);
-        */
+        bumpCounter(tbhits);
+        TT::save(pos, score, 0, depth, hash_type_exact, EvalNone);
+        return score;
     }
 
 
@@ -245,18 +425,27 @@ int negamax(int alpha, int beta, int depth)
     // decide whether to search deeper (check extension).
 
     // init PV length
-    pv_length[ply] = ply;
+    pv_length[pos.ply] = pos.ply;
 
     // number of legal moves found
     int legal = 0;
 
+    // check the limits of the search, and stop as soon as they are reached
+    if (isMainThread)
+        checkLimits();
+
+    if (timedout)
+        return 0;
+
+
     // increment nodes count
-    nodes++;
+    bumpCounter(nodes);
+    STAT_INC(StatNodes);
 
     // is king in check? --> needed for detecting mate and in-check extension
-    bool inCheck = isSquareAttacked((sideToMove == White) ? ls1b(bitboards[K]) : 
-                                                            ls1b(bitboards[k]),
-                                                            sideToMove ^ 1);
+    bool inCheck = isSquareAttacked(pos, (pos.sideToMove == White) ? ls1b(pos.bitboards[K]) :
+                                                                     ls1b(pos.bitboards[k]),
+                                                                     pos.sideToMove ^ 1);
 
 
 
@@ -292,7 +481,7 @@ int negamax(int alpha, int beta, int depth)
     // @see https://www.chessprogramming.org/Quiescence_Search
 
     if (depth == 0)
-        return qsearch(alpha, beta);
+        return qsearch(pos, alpha, beta);
 
 
 
@@ -305,8 +494,14 @@ int negamax(int alpha, int beta, int depth)
     // what is the current static evaluation of the position. This will be then
     // used in conjunction with different margins and bonuses to check whether
     // we can fail low or high immediately without ending in the full search.
+    //
+    // The raw NNUE score may be stored in the TT already, otherwise it may be
+    // found in the evaluation cache, so the network is only evaluated once.
+    // Note that a false TT hit (entries are matched on 16 bits of the key)
+    // also gives a wrong static evaluation, not only a wrong score and move.
 
-    StaticEval = evaluate();
+    nnueEval   = evaluateNNUE(pos, nnueEval);
+    StaticEval = scaleEval(pos, nnueEval);
 
 
 
@@ -319,11 +514,12 @@ int negamax(int alpha, int beta, int depth)
     //
     // @see https://www.chessprogramming.org/Razoring
 
-    if (ply && !pv_node
+    if (pos.ply && !pv_node
             && (depth < 2)
             && ((StaticEval + RazorMargin) <= alpha))
     {
-        return qsearch(alpha, beta);
+        STAT_INC(StatRazoring);
+        return qsearch(pos, alpha, beta);
     }
 
     
@@ -344,7 +540,10 @@ int negamax(int alpha, int beta, int depth)
     {
         EvalMargin = depth * RFPMargin;
         if ((depth < 9) && (StaticEval - EvalMargin) >= beta)
-                return (StaticEval - EvalMargin);
+        {
+            STAT_INC(StatRFP);
+            return (StaticEval - EvalMargin);
+        }
     }
 
 
@@ -361,7 +560,7 @@ int negamax(int alpha, int beta, int depth)
     //
     // @see https://www.chessprogramming.org/Null_Move_Pruning
 
-    if (!pv_node && allowNull && (depth >= 3) && !noMajorsOrMinors())
+    if (!pv_node && allowNull && (depth >= 3) && !noMajorsOrMinors(pos))
     {
         // R: is the reduction factor. The larger the R, the shallower the
         //    search is and the faster (but likely less reliable) the pruning
@@ -372,43 +571,28 @@ int negamax(int alpha, int beta, int depth)
         // @see https://github.com/algerbrex/blunder/blob/main/engine/search.go
         int R = 3 + depth/6;
 
-        // preserve board state
-        saveBoard();
-        
+        STAT_INC(StatNullTried);
+
         // increment ply
-        ply++;
-        
-        // increment repetition index & store hash key
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
-        
-        // hash enpassant if available
-        if (epsq != NoSq)
-            hash_key ^= enpassant_keys[epsq];
-        
-        // reset enpassant capture square
-        epsq = NoSq;
-        
+        pos.ply++;
+
         // switch the side, literally giving opponent an extra move to make
-        sideToMove ^= 1;
-        
-        // hash the side
-        hash_key ^= side_key;
+        makeNullMove(pos);
 
         // avoid doing 2 null moves in sequence
         allowNull = false;
                 
-        // search moves with reduced depth to find beta cutoffs
-        score = -negamax(-beta, -beta + 1, depth - R - 1);
+        // search moves with reduced depth to find beta cutoffs (at least
+        // down to qsearch, the reduction can't make the depth negative)
+        score = -negamax(pos, -beta, -beta + 1, std::max(0, depth - R - 1));
 
         // restore allowNull
         allowNull = true;
 
 
         // undo the null move
-        repetition_index--;
-        ply--;
-        takeBack();
+        pos.ply--;
+        takeNullMove(pos);
 
 
         // check if time is up
@@ -418,7 +602,10 @@ int negamax(int alpha, int beta, int depth)
 
         // fail-hard beta cutoff
         if (score >= beta)
+        {
+            STAT_INC(StatNullCutoffs);
             return beta;
+        }
     }
 
 
@@ -435,7 +622,7 @@ int negamax(int alpha, int beta, int depth)
     //
     // @see https://www.chessprogramming.org/Futility_Pruning
 
-    if (ply && !pv_node && (depth <= 8))
+    if (pos.ply && !pv_node && (depth <= 8))
         if ((StaticEval + futility_margin(depth)) <= alpha)
 			canFutilityPrune = true;
 
@@ -457,18 +644,11 @@ int negamax(int alpha, int beta, int depth)
  
         
     
-    // create a new move list and generate the moves
-    MoveList_t MoveList;
-    generateMoves(MoveList);
-
-
-    // if we are following PV line, enable PV move scoring
-    if (followPV)
-        enablePV_scoring(MoveList);
-
-
-    // sort moves from best to worst
-    sortMoves(MoveList, bestmove);
+    // create a move picker to generate the moves lazily, in stages, starting
+    // with the TT move (if any)
+    MovePicker_t mp;
+    initMovePicker(pos, mp, bestmove, false);
+    int move;
 
 
     // number of moves searched so far, within a move list
@@ -483,37 +663,26 @@ int negamax(int alpha, int beta, int depth)
     // After doing all the early pruning, we jump into the main loop of going
     // through the moves available and search the score for each of them.
 
-    for (int count = 0; count < MoveList.count; count++)
+    while ((move = nextMove(pos, mp)))
     {
-        // preserve board state
-        saveBoard();
-       
+        // at the root, only search the moves preserving the tablebase result,
+        // and skip the moves of the PV lines already searched (MultiPV)
+        if (!pos.ply && (!TB::isRootMove(move) || isExcludedMove(move)))
+            continue;
 
-        // increment ply
-        ply++;
 
+        // increment ply
+        pos.ply++;
 
-        // increment repetition index & store hash key
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
-       
 
-        // make the move and check if it is illegal - skip it if so
-        if (!makeMove(MoveList.moves[count]))
-        {
-            // in case of illegal move, undo it and skip to the next one
-            repetition_index--;
-            ply--;
-            takeBack();
-            
-            continue;
-        }
+        // make the move
+        makeMove(pos, move);
 
 
         // used for avoiding reductions on moves that give check
-        bool givesCheck = isSquareAttacked((sideToMove == White) ? ls1b(bitboards[K]) : 
-                                                                   ls1b(bitboards[k]),
-                                                                   sideToMove ^ 1);
+        bool givesCheck = isSquareAttacked(pos, (pos.sideToMove == White) ? ls1b(pos.bitboards[K]) :
+                                                                        ls1b(pos.bitboards[k]),
+                                                                        pos.sideToMove ^ 1);
 
 
         // increment legal moves
@@ -529,7 +698,7 @@ int negamax(int alpha, int beta, int depth)
         // obtain a score that will guide the next searches.
 
         if (moves_searched == 0)
-            score = -negamax(-beta, -alpha, depth - 1);
+            score = -negamax(pos, -beta, -alpha, depth - 1);
 
 
 
@@ -549,19 +718,19 @@ int negamax(int alpha, int beta, int depth)
 
             if (canFutilityPrune && (legal > 1))
             {
-                if (!givesCheck && (killers[0][ply] != MoveList.moves[count])
-                                && (killers[1][ply] != MoveList.moves[count])
-                                && (getMovePiece(MoveList.moves[count]) != P)
-                                && (getMovePiece(MoveList.moves[count]) != p)
-                                && !getPromo(MoveList.moves[count])
-                                && !getCastle(MoveList.moves[count])
-                                && !getMoveCapture(MoveList.moves[count]))
+                if (!givesCheck && (mp.killer1 != move)
+                                && (mp.killer2 != move)
+                                && (getMovePiece(move) != P)
+                                && (getMovePiece(move) != p)
+                                && !getPromo(move)
+                                && !getCastle(move)
+                                && !getMoveCapture(move))
                 {
                     // undo the current move and skip to the next one
-                    repetition_index--;
-                    ply--;
-                    takeBack();
+                    pos.ply--;
+                    takeBack(pos);
 
+                    STAT_INC(StatFutility);
                     continue;
                 }
             }
@@ -578,17 +747,17 @@ int negamax(int alpha, int beta, int depth)
             // miss a tactical move however, so the further away we prune from
             // the horizon, the "later" the move needs to be.
 
-		    if (ply && !pv_node
+		    if (pos.ply && !pv_node
                     && (depth <= 3)
                     && !inCheck
-                    && !getMoveCapture(MoveList.moves[count])
+                    && !getMoveCapture(move)
                     && (legal > LateMovePruningMargins[depth]))
             {
                 // undo the current move and skip to the next one
-                repetition_index--;
-                ply--;
-                takeBack();
+                pos.ply--;
+                takeBack(pos);
 
+                STAT_INC(StatLMP);
                 continue;
 			}
 
@@ -606,11 +775,17 @@ int negamax(int alpha, int beta, int depth)
             //
             // @see https://www.chessprogramming.org/Late_Move_Reductions
 
-            if (ply && (legal >= LMRFullDepthMoves)
+            if (pos.ply && (legal >= LMRFullDepthMoves)
                     && (depth >= LMRReductionLimit)
                     && !inCheck
-                    && !getMoveCapture(MoveList.moves[count]))
-                score = -negamax(-alpha - 1, -alpha, depth - 2);
+                    && !getMoveCapture(move))
+            {
+                STAT_INC(StatLMR);
+                score = -negamax(pos, -alpha - 1, -alpha, depth - 2);
+
+                if (score > alpha)
+                    STAT_INC(StatLMRReSearches);
+            }
 
             
             // hack to ensure that full-depth search is done next
@@ -630,7 +805,7 @@ int negamax(int alpha, int beta, int depth)
 
             if (score > alpha)
             {
-                score = -negamax(-alpha - 1, -alpha, depth - 1);
+                score = -negamax(pos, -alpha - 1, -alpha, depth - 1);
         
 
                 // If the algorithm finds out that it was wrong, and that one of
@@ -640,16 +815,18 @@ int negamax(int alpha, int beta, int depth)
                 // not often enough to counteract the savings gained from doing
                 // the "bad move proof" search referred to earlier.
                 if ((score > alpha) && (score < beta))
-                    score = -negamax(-beta, -alpha, depth - 1);
+                {
+                    STAT_INC(StatPVSReSearches);
+                    score = -negamax(pos, -beta, -alpha, depth - 1);
+                }
             }
         }
 
 
         
         // undo the move after the search
-        repetition_index--;
-        ply--;
-        takeBack();
+        pos.ply--;
+        takeBack(pos);
 
 
 
@@ -672,12 +849,12 @@ int negamax(int alpha, int beta, int depth)
 
 
             // store the best move in the TT
-            bestmove = MoveList.moves[count];
+            bestmove = move;
 
 
             // store history moves (only for quiet moves)
-            if (!getMoveCapture(MoveList.moves[count]))
-                history[getMovePiece(MoveList.moves[count])][getMoveTarget(MoveList.moves[count])] += depth;
+            if (!getMoveCapture(move))
+                history[getMovePiece(move)][getMoveTarget(move)] += depth;
 
 
             // PV node (move)
@@ -685,34 +862,39 @@ int negamax(int alpha, int beta, int depth)
 
 
             // write PV move
-            pv_table[ply][ply] = MoveList.moves[count];
+            pv_table[pos.ply][pos.ply] = move;
 
             
             // copy moves from deeper ply into current ply's line
-            for (int next_ply = ply + 1; next_ply < pv_length[ply + 1]; next_ply++)
-                pv_table[ply][next_ply] = pv_table[ply + 1][next_ply];
+            for (int next_ply = pos.ply + 1; next_ply < pv_length[pos.ply + 1]; next_ply++)
+                pv_table[pos.ply][next_ply] = pv_table[pos.ply + 1][next_ply];
            
 
             // adjust PV length
-            pv_length[ply] = pv_length[ply + 1];            
+            pv_length[pos.ply] = pv_length[pos.ply + 1];            
 
         
             // fail-high (beta cutoff)
             if (score >= beta)
             {
                 // store hash entry with the score equal to beta, only if not null move
-                TT::save(beta, bestmove, depth, hash_type_beta);
+                TT::save(pos, beta, bestmove, depth, hash_type_beta, nnueEval);
                
 
                 // store killer moves (only for quiet moves)
-                if (!getMoveCapture(MoveList.moves[count]))
+                if (!getMoveCapture(move))
                 {
-                    killers[1][ply] = killers[0][ply];
-                    killers[0][ply] = MoveList.moves[count];
+                    killers[1][pos.ply] = killers[0][pos.ply];
+                    killers[0][pos.ply] = move;
                 }
 
 
-                // node (move) fails high
+                // node (move) fails high, record how late in the move list
+                STAT_INC(StatBetaCutoffs);
+                STAT_ADD(StatCutoffMoves, moves_searched);
+                if (moves_searched == 1)
+                    STAT_INC(StatFirstMoveCutoffs);
+
                 return beta;
             }
         }
@@ -730,12 +912,12 @@ int negamax(int alpha, int beta, int depth)
     {
         // king is in check: return mating score (closest distance to mate)
         if (inCheck)
-            return -MateValue + ply;
+            return -MateValue + pos.ply;
         
         // king not in check: stalemate
         else
             //return DRAWSCORE;
-            return contempt();
+            return contempt(pos);
     }
 
 
@@ -746,7 +928,7 @@ int negamax(int alpha, int beta, int depth)
     //
     // After finishing the search, we make sure we update the Transposition
     // Table with the best move.
-    TT::save(alpha, bestmove, depth, hash_type);
+    TT::save(pos, alpha, bestmove, depth, hash_type, nnueEval);
 
    
 
@@ -761,14 +943,16 @@ int negamax(int alpha, int beta, int depth)
 //
 // The search is started when the program receives the UCI 'go'
 // command. It searches from the root position and outputs the "bestmove".
-void search()
+void search(Position_t &pos)
 {
     // reliability checks
     assert(Limits.depth >= 0);
 
 
-    // set the flag for the engine to know the search is started
-    timedout = false;
+    // this thread checks the limits of the search; note that the "time is
+    // up" flag is reset when the search is set up (see resetTimeControl()),
+    // so that a "stop" received right after "go" is not lost
+    isMainThread = true;
 
 
     // define best score
@@ -780,29 +964,35 @@ void search()
 
 
     // reset data structures for a new search
-    memset(killers, 0, sizeof(killers));
-    memset(history, 0, sizeof(history));
-    memset(pv_table, 0, sizeof(pv_table));
-    memset(pv_length, 0, sizeof(pv_length));
+    resetSearchData();
+    TT::newSearch();
 
 
-    // reset follow PV flags
-    followPV   = false;
-    scorePV    = false;
-    allowNull  = true;
+    // if the root position is in the tablebases, restrict the search to the
+    // moves preserving the best result
+    TB::filterRootMoves(pos);
 
 
-    // define initial alpha beta bounds
-    int alpha = -ValueInfinite;
-    int beta  =  ValueInfinite;
+    // number of PV lines to search and report (MultiPV), which can't be
+    // more than the number of root moves, and their initial (full-width)
+    // aspiration windows
+    int multiPV = std::min(Options["MultiPV"], std::max(1, countRootMoves(pos)));
 
+    for (int i = 0; i < multiPV; i++)
+    {
+        rootLines[i].score  = -ValueInfinite;
+        rootLines[i].alpha  = -ValueInfinite;
+        rootLines[i].beta   =  ValueInfinite;
+        rootLines[i].length =  0;
+    }
 
-    // reset nodes counter
-    nodes = 0ULL;
+
+    // reset the search statistics of all the threads
+    Stats::clear();
 
 
-    // reset "time is up" flag
-    timedout = false;
+    // wake up the helper threads (lazy SMP)
+    Threads::startHelpers(pos);
 
 
     // iterative deepening framework
@@ -813,35 +1003,81 @@ void search()
             break;
 
 
-        // enable follow PV flag
-        followPV = true;
+        // search the PV lines one after the other: every line excludes the
+        // root moves of the lines already searched in this iteration, and it
+        // has its own aspiration window
+        excludedCount = 0;
+
+        for (int pvIdx = 0; (pvIdx < multiPV) && !timedout; pvIdx++)
+        {
+            RootLine_t &line = rootLines[pvIdx];
+
+
+            // follow the PV of this line from the previous iteration (with a
+            // single line, it's already in the PV table)
+            if (multiPV > 1)
+            {
+                memcpy(pv_table[0], line.pv, line.length * sizeof(int));
+                pv_length[0] = line.length;
+            }
+
+
+            // enable follow PV flag
+            followPV = true;
    
 
-        // find best move within a given position
-        score = negamax(alpha, beta, current_depth);
+            // find best move within a given position
+            score = negamax(pos, line.alpha, line.beta, current_depth);
 
 
+            // an unfinished search doesn't give a reliable score
+            if (timedout)
+                break;
 
-        ////////////////////////////////////////////////////////////////////////
-        //
-        // Aspiration Window
-        //
-        // Search with a narrow window, keep narrowing it after each iteration.
-        // However, if the score falls outside the window, we must try again
-        // with a full-width window (and the same depth).
 
-        if ((score <= alpha) || (score >= beta))
-        {
-            alpha = -ValueInfinite;
-            beta  =  ValueInfinite;
-            current_depth--;
-            continue;
+
+            ////////////////////////////////////////////////////////////////////
+            //
+            // Aspiration Window
+            //
+            // Search with a narrow window, keep narrowing it after each
+            // iteration. However, if the score falls outside the window, we
+            // must try again with a full-width window (and the same depth).
+
+            if ((score <= line.alpha) || (score >= line.beta))
+            {
+                line.alpha = -ValueInfinite;
+                line.beta  =  ValueInfinite;
+                pvIdx--;
+                continue;
+            }
+
+
+            // set up the window for the next iteration
+            line.alpha = score - AspirationWindow;
+            line.beta  = score + AspirationWindow;
+
+
+            // keep the result of this line, and exclude its move from the
+            // next lines
+            line.score  = score;
+            line.length = pv_length[0];
+            memcpy(line.pv, pv_table[0], line.length * sizeof(int));
+
+            excludedMoves[excludedCount++] = pv_table[0][0];
         }
 
 
-        // set up the window for the next iteration
-        alpha = score - AspirationWindow;
-        beta  = score + AspirationWindow;
+        // the lines are only reported once the iteration is complete
+        if (timedout)
+            break;
+
+
+        // the best line goes first (the lines keep their windows)
+        stable_sort(rootLines, rootLines + multiPV, [](const RootLine_t &a, const RootLine_t &b)
+        {
+            return a.score > b.score;
+        });
 
 
         // stop the timer and measure time elapsed
@@ -850,43 +1086,195 @@ void search()
         auto ns = chrono::duration_cast<chrono::nanoseconds>(finish-start).count();
         
     
-        // print bestmove and PV line
-        if (pv_length[0])
-        {
-            cout << "info depth " << current_depth;
+        // print the PV lines
+        for (int i = 0; i < multiPV; i++)
+            printLine(rootLines[i], current_depth, (multiPV > 1) ? i + 1 : 0, ms, ns);
 
-            // report mating distance if available, otherwise print score
-            if ((score > -MateValue) && (score < -MateScore))
-                cout << " score mate " << -(score + MateValue) / 2 - 1;
-            else if ((score > MateScore) && (score < MateValue))
-                cout << " score mate " << (MateValue - score) / 2 + 1;
-            else
-                cout << " score cp " << score;
-
-            // other search information: nodes, nps, time, etc.
-            cout << " nodes " <<  nodes
-                 << " nps " << nodes * 1000000000 / ns
-                 << " hashfull " << TT::hashfull()
-                 << " time " << ms
-                 << " pv ";
-            
-            // print PV line
-            for (int count = 0; count < pv_length[0]; count++)
-                cout << prettyMove(pv_table[0][count]) << " ";
 
+        // let the time manager decide whether there's time for another
+        // iteration; while pondering, keep searching and just remember to
+        // stop as soon as the opponent plays the expected move
+        if (Time::iterationDone(rootLines[0].pv[0]))
+        {
+            if (!pondering)
+                break;
 
-            // new line before next depth
-            cout << endl << flush;
+            stopOnPonderhit = true;
         }
     }
 
 
-    // print bestmove
-    cout << "bestmove " << prettyMove(pv_table[0][0]) << endl << flush;
+    // the best move comes from the best line (with a single line, it's
+    // already in the PV table, even if the last iteration was not complete)
+    if (multiPV > 1)
+    {
+        memcpy(pv_table[0], rootLines[0].pv, rootLines[0].length * sizeof(int));
+        pv_length[0] = rootLines[0].length;
+    }
+
 
+    // the UCI protocol doesn't allow "bestmove" while pondering, so (e.g.,
+    // when the depth limit is reached) wait for "ponderhit" or "stop"
+    while (pondering && !timedout)
+        pondering.wait(true);
 
-    // tell the engine that the search is ready
+
+    // tell the engine (and the helper threads) that the search is ready
     timedout = true;
+    Threads::waitHelpers();
+
+
+    // report the search statistics to the GUI, if enabled, after the info
+    // lines sent so far
+    #ifdef USE_STATS
+        Threads::flushOutput();
+        Stats::print(true);
+    #endif
+
+
+    // print bestmove, and the expected reply to ponder on, if any
+    output = "bestmove " + prettyMove(pv_table[0][0]);
+
+    if (pv_length[0] > 1)
+        output += " ponder " + prettyMove(pv_table[0][1]);
+
+    output += "\n";
+    Threads::send(output);
+}
+
+
+
+// analyzePosition
+//
+// Search a position to the given depth on the calling thread, without any
+// output, and return its score (from the point of view of the side to move)
+// along with its best move. This is used by the batch analysis ("analyze"),
+// where every thread searches its own positions, sharing only the TT.
+int analyzePosition(Position_t &pos, int depth, int &bestMove)
+{
+    // score of the current and of the last complete iteration
+    int score, result = 0;
+
+
+    // reset data structures for a new search
+    resetSearchData();
+
+
+    // define initial alpha beta bounds
+    int alpha = -ValueInfinite;
+    int beta  =  ValueInfinite;
+
+
+    // iterative deepening, with the same aspiration windows as search()
+    for (int current_depth = 1; current_depth <= depth; current_depth++)
+    {
+        followPV = true;
+        score = negamax(pos, alpha, beta, current_depth);
+
+        if (timedout)
+            break;
+
+        if ((score <= alpha) || (score >= beta))
+        {
+            alpha = -ValueInfinite;
+            beta  =  ValueInfinite;
+            current_depth--;
+            continue;
+        }
+
+        alpha  = score - AspirationWindow;
+        beta   = score + AspirationWindow;
+        result = score;
+    }
+
+
+    bestMove = pv_table[0][0];
+
+    return result;
+}
+
+
+
+// stopSearch
+//
+// Stop the current search (if any) as soon as possible, even when pondering:
+// the search prints "bestmove" and finishes.
+void stopSearch()
+{
+    timedout  = true;
+    pondering = false;
+    pondering.notify_all();
+}
+
+
+
+// ponderhit
+//
+// The opponent played the move the engine was pondering on: go on with the
+// same search, but now under the normal time limits of the "go" command.
+// The time spent pondering counts as thinking time, so the search stops
+// right away if the time manager wanted to stop it already.
+void ponderhit()
+{
+    pondering = false;
+    pondering.notify_all();
+
+    if (stopOnPonderhit)
+        timedout = true;
+}
+
+
+
+// helperSearch
+//
+// Search loop of the helper threads (lazy SMP). Every helper searches the
+// root position on its own board using iterative deepening, without any
+// output, until the main thread stops the search. Half of the helpers start
+// one ply deeper, so that not all threads search the same depth at the same
+// time. Their results are shared with the main thread through the TT.
+void helperSearch(Position_t &pos, int id)
+{
+    // score of the current iteration
+    int score;
+
+
+    // reset data structures for a new search
+    resetSearchData();
+
+
+    // define initial alpha beta bounds
+    int alpha = -ValueInfinite;
+    int beta  =  ValueInfinite;
+
+
+    // iterative deepening framework
+    for (int current_depth = 1 + (id & 1); current_depth <= Limits.depth; current_depth++)
+    {
+        // enable follow PV flag
+        followPV = true;
+
+
+        // search the root position
+        score = negamax(pos, alpha, beta, current_depth);
+
+
+        // stop as soon as the main thread is done
+        if (timedout)
+            break;
+
+
+        // aspiration window (see search())
+        if ((score <= alpha) || (score >= beta))
+        {
+            alpha = -ValueInfinite;
+            beta  =  ValueInfinite;
+            current_depth--;
+            continue;
+        }
+
+        alpha = score - AspirationWindow;
+        beta  = score + AspirationWindow;
+    }
 }
 
 
@@ -899,23 +1287,33 @@ void search()
 // a) no more possible captures
 // b) no more pawn promotions
 // c) depth is too deep or time (from a running timer) is up
-int qsearch(int alpha, int beta)
+int qsearch(Position_t &pos, int alpha, int beta)
 {
     // start searching a score from the beginning (= -ValueInfinite)
     int val, score;
 
 
+    // check the limits of the search, and stop as soon as they are reached
+    if (isMainThread)
+        checkLimits();
+
+    if (timedout)
+        return 0;
+
+
     // increment nodes count
-    nodes++;
+    bumpCounter(nodes);
+    STAT_INC(StatQNodes);
+    STAT_MAX(StatQSearchMaxPly, pos.ply);
 
 
     // we are too deep, hence there's an overflow of arrays relying on max ply constant
-    if (ply > (MaxPly - 1))
-        return evaluate();
+    if (pos.ply > (MaxPly - 1))
+        return evaluate(pos);
 
 
     // calculate "stand-pat" to stabilize the qsearch
-    val = evaluate();
+    val = evaluate(pos);
 
 
     // beta-cutoff
@@ -928,53 +1326,31 @@ int qsearch(int alpha, int beta)
         alpha = val;
    
 
-    // generate a new move list and sort it
-    MoveList_t MoveList;
-    generateCapturesAndPromotions(MoveList);
-    sortMoves(MoveList, 0);
+    // create a move picker for captures and promotions only: capture
+    // sequences that end up in losing material are not searched
+    MovePicker_t mp;
+    initMovePicker(pos, mp, 0, true);
+    int move;
 
     
-    // loop over moves within a movelist
-    for (int count = 0; count < MoveList.count; count++)
+    // loop over the moves picked
+    while ((move = nextMove(pos, mp)))
     {
-        // don't search capture sequences that end up in losing material
-        if (see(MoveList.moves[count]) < 0)
-            continue;
-
-
-        // preserve board state
-        saveBoard();
-       
-
         // increment ply
-        ply++;
+        pos.ply++;
 
         
-        // increment repetition index & store hash key
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
-
-        
-        // make sure to make only legal moves
-        if (!makeMove(MoveList.moves[count]))
-        {
-            // in case of illegal move, undo it and skip to the next one
-            repetition_index--;
-            ply--;
-            takeBack();
-            
-            continue;
-        }
+        // make the move
+        makeMove(pos, move);
 
 
         // score current move
-        score = -qsearch(-beta, -alpha);
+        score = -qsearch(pos, -beta, -alpha);
        
 
         // undo the move after we got its score
-        repetition_index--;
-        ply--;
-        takeBack();
+        pos.ply--;
+        takeBack(pos);
 
 
         // check if time is up
@@ -1002,19 +1378,51 @@ int qsearch(int alpha, int beta)
 
 
 
+// initPerftHash
+//
+// Allocate the perft hash table with the given size in MBytes (rounded down
+// to a power of 2 number of entries), or free it if the size is 0.
+void initPerftHash(int mb)
+{
+    // free the previous table, if any
+    delete[] perft_table;
+    perft_table      = nullptr;
+    perft_table_mask = 0ULL;
+
+    if (mb <= 0)
+        return;
+
+
+    // largest power of 2 number of entries fitting in the given size
+    uint64_t entries = 1ULL;
+    while ((entries * 2 * sizeof(PerftEntry_t)) <= ((uint64_t)mb * 1024 * 1024))
+        entries *= 2;
+
+
+    // allocate a zeroed table: key 0 and data 0 never match a depth > 1
+    perft_table      = new PerftEntry_t[entries]();
+    perft_table_mask = entries - 1;
+}
+
+
+
 // dperft
 //
 // Divide-perft is a perft() wrapper that divides a position into each
 // root move and calls perft() for each of them. This is very useful
 // to debug possible errors within the move generator for a given root move.
-void dperft(int depth)
+//
+// The root moves are split across as many threads as set in the "Threads"
+// option, each of them with its own copy of the position. The results are
+// printed in the order of the moves generated, once all of them are done.
+void dperft(Position_t &pos, int depth)
 {
     // reliability checks
     assert(depth > 0);
 
 
     // reset nodes count
-    nodes = 0ULL;
+    nodes.store(0ULL, memory_order_relaxed);
    
 
     // create move list instance
@@ -1022,46 +1430,50 @@ void dperft(int depth)
 
     
     // generate moves
-    generateMoves(MoveList);
+    generateMoves(pos, MoveList);
 
     
     // init start time
     auto start = chrono::high_resolution_clock::now();
-   
 
-    // loop over generated moves
-    for (int move_count = 0; move_count < MoveList.count; move_count++)
-    {   
-        // preserve board state
-        saveBoard();
 
+    // nodes under every root move, and next root move to be searched
+    vector<uint64_t> counts(MoveList.count, 0ULL);
+    atomic<int> next(0);
 
-        // make move and, if illegal, skip to the next move
-        if (!makeMove(MoveList.moves[move_count]))
-        {
-            takeBack();
-            continue;
-        }
 
+    // search the root moves in parallel: every thread takes the next root
+    // move available until all of them are done
+    int n = std::min(std::max(1, Options["Threads"]), std::max(1, MoveList.count));
+    vector<thread> workers;
 
-        // cummulative nodes
-        uint64_t cNodes = nodes;
-
+    for (int i = 0; i < n; i++)
+    {
+        workers.emplace_back([&]()
+        {
+            Position_t *copy = new Position_t;
+            *copy = pos;
 
-        // call perft driver recursively
-        perft(depth - 1);
+            for (int m = next++; m < MoveList.count; m = next++)
+            {
+                makeMove(*copy, MoveList.moves[m]);
+                counts[m] = perft(*copy, depth - 1);
+                takeBack(*copy);
+            }
 
-        
-        // old nodes
-        uint64_t PrevNodes = nodes - cNodes;
+            delete copy;
+        });
+    }
 
-        
-        // undo move
-        takeBack();
+    for (thread &t : workers)
+        t.join();
 
 
-        // print move and nodes under that move
-        cout << prettyMove(MoveList.moves[move_count]) << ": " << PrevNodes << endl;
+    // print every root move and the nodes under that move
+    for (int move_count = 0; move_count < MoveList.count; move_count++)
+    {
+        cout << prettyMove(MoveList.moves[move_count]) << ": " << counts[move_count] << endl;
+        bumpCounter(nodes, counts[move_count]);
     }
 
 
@@ -1074,79 +1486,10 @@ void dperft(int depth)
     // print results
     cout << endl;
     cout << "    Depth: " << depth << endl;
-    cout << "    Nodes: " << nodes << endl;
+    cout << "    Nodes: " << nodes.load(memory_order_relaxed) << endl;
     cout << fixed << setprecision(3);
     cout << "    Time:  " << ns / 1000000.0 << "ms" << endl;
-    cout << "   Speed:  " << nodes * 1000000 / ns << " Knps" << endl << endl;
-}
-
-
-
-// sortMoves
-//
-// Take a MoveList_t and sort it in descending order by move score.
-//
-// sortMoves() works in a way that goes through every move in the move
-// list, gets a score for every move (based on MVV/LVA, PV node, and
-// other heuristics), and sorts the list from bigger score to smaller 
-// score. In other words, sortMoves() tries to bring the best move to
-// the front.
-//
-// If a "best move" is found in the transposition table, it is placed
-// at the top, making it the first move to be searched.
-void sortMoves(MoveList_t &MoveList, int bestmove)
-{
-    // reliability checks
-    assert(MoveList.count > 0);
-    assert(MoveList.count < 256);
-
-
-    // associative array linking moves and scores
-    pair<int, int> pairt[256];
-
-
-    // find the score for every move
-    for (int i = 0; i < MoveList.count; i++) 
-    {
-        // score bestmove (from TT) above all
-        if (MoveList.moves[i] == bestmove)
-            pairt[i].first = 30000;
-
-        // rest of moves are scored using scoreMove()
-        else
-            pairt[i].first  = scoreMove(MoveList.moves[i]);
-
-        // associate score with the move
-        pairt[i].second = MoveList.moves[i];
-    }
-  
-    // sort the associative array based on the move score
-    sort(pairt, pairt + MoveList.count, greater<pair<int, int>>());
-     
-
-    // re-write the MoveList ordered by move score in descending order
-    for (int i = 0; i < MoveList.count; i++) 
-        MoveList.moves[i] = pairt[i].second;
-}
-
-
-
-// printMoveScores
-//
-// This function is for testing move scoring and ordering.
-void printMoveScores(MoveList_t &MoveList)
-{
-    cout << "     Move scores:" << endl << endl;
-       
-
-    // loop over moves within a move list
-    for (int count = 0; count < MoveList.count; count++)
-    {
-        cout << "     move: ";
-        cout << prettyMove(MoveList.moves[count]);
-        cout << " score: " << scoreMove(MoveList.moves[count]) << endl;
-    }
-    cout << endl << endl;
+    cout << "   Speed:  " << nodes.load(memory_order_relaxed) * 1000000 / ns << " Knps" << endl << endl;
 }
 
 
@@ -1158,13 +1501,12 @@ void printMoveScores(MoveList_t &MoveList)
 void resetTimeControl()
 {
     // reset timing
-    inc       = 0;
     stoptime  = 0;
-    timeset   = 1;
+    timeset   = false;
     timedout  = false; 
 
     starttime = getTimeInMilliseconds();
-    Limits.movestogo = 30;
+    Limits.movestogo =  0;
     Limits.movetime  =  0;
 }
 
@@ -1176,7 +1518,7 @@ void resetTimeControl()
 // (static exchange evaluation), and return the final score of the move 
 // (after completing all the captures) from the perspective of the side
 // to move.
-int see(int move)
+int see(Position_t &pos, int move)
 {
     // total static evaluation after all possible exchanges have been made
     std::array<int, 32> gain;
@@ -1188,7 +1530,7 @@ int see(int move)
 
 
     // change side to move
-    int stm = sideToMove ^ 1;
+    int stm = pos.sideToMove ^ 1;
 
 
     // initialize origin and target square, as well as attacker and target piece
@@ -1198,38 +1540,23 @@ int see(int move)
 
     
     // identify the piece on the target square
-    int start_piece = P, end_piece = K, target = -1;
-    
-    if (stm == Black)
-    {
-        start_piece = p;
-        end_piece = k;
-    }
-
-    for (int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
-    {
-        if (getBit(bitboards[bb_piece], toSq))
-        {
-            target = bb_piece;
-            break;
-        }
-    }
+    int target = pos.board[toSq];
 
 
     // if no piece to capture at target, this is not a capture
-    if (target < 0)
+    if (target == NoPiece)
         return 0;
 
 
     // temporary bitboards to run the exchange simulation
     Bitboard seenBB     = 0ULL;
-	Bitboard occupiedBB = occupancies[White] | occupancies[Black];
+	Bitboard occupiedBB = pos.occupancies[White] | pos.occupancies[Black];
 	Bitboard attackerBB = SqBB[fromSq];
 
 
     // list of attackers and defenders to a given square
-    Bitboard attadef = getAttackers(White, toSq, occupiedBB) | getAttackers(Black, toSq, occupiedBB);
-    Bitboard maxXray = occupiedBB & ~(bitboards[N] | bitboards[K] | bitboards[n] | bitboards[k]);
+    Bitboard attadef = getAttackers(pos, White, toSq, occupiedBB) | getAttackers(pos, Black, toSq, occupiedBB);
+    Bitboard maxXray = occupiedBB & ~(pos.bitboards[N] | pos.bitboards[K] | pos.bitboards[n] | pos.bitboards[k]);
 
 
     // calcualte initial win, from the first capture
@@ -1250,9 +1577,9 @@ int see(int move)
         seenBB |= attackerBB;
 
         if ((attackerBB & maxXray) != 0)
-            attadef |= considerXrays(toSq, occupiedBB) & ~seenBB;
+            attadef |= considerXrays(pos, toSq, occupiedBB) & ~seenBB;
 
-        attackerBB = minAttacker(attadef, stm, attacker);
+        attackerBB = minAttacker(pos, attadef, stm, attacker);
         stm ^= 1;
     }
 
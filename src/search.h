@@ -25,16 +25,16 @@
 #include <chrono>
 #include <string>
 #include <thread>
-#include <future>
+#include <atomic>
 
 #ifdef WIN64
     #include <windows.h>
 #else
     #include <sys/time.h>
-    #include <sys/select.h>
 #endif
 
 #include "movgen.h"
+#include "thread.h"
 
 
 
@@ -50,7 +50,7 @@ using namespace std;
 #define LMRFullDepthMoves             4
 #define LMRReductionLimit             3
 #define AspirationWindow             70
-#define WatchIntervalMs              10
+#define CheckInterval              1024
 
 #define MaxSearchTime  0xFFFFFFFFFFFFFFFFULL
 
@@ -67,21 +67,22 @@ using namespace std;
 
 // Default options (settings) at startup
 #define OptionsDefaultHashSize      1024 
+#define OptionsDefaultThreads          1
 #define OptionsDefaultContempt        25
 #define OptionsContemptMin             0
 #define OptionsContemptMax           200
-
-
-
-// Maximum depth at which we try to search
-#define MaxPly            256
+#define OptionsDefaultPerftHash        0
+#define OptionsDefaultMoveOverhead    50
+#define OptionsDefaultMultiPV          1
+#define OptionsMultiPVMax            256
+#define OptionsMoveOverheadMax      5000
 
 
 
 // Score assigned to non-capture promotions. This is used for
 // sorting moves based on their likeliness to be good.
 //
-// @see scoreMove() and sortMoves()
+// @see scoreMove() and nextMove()
 #define MoveScorePromoQuiet   10000
 
 
@@ -89,7 +90,29 @@ using namespace std;
 // 'nodes' is a global variable holding the number of nodes analyzed
 // or searched. It is used by negamax() but also other performance test
 // functions such as perft().
-extern uint64_t nodes;
+//
+// Every search thread counts its own nodes (thread_local), the total number
+// of nodes searched is given by Threads::nodes(). Other threads read the
+// counters during the search, hence they are atomic (see bumpCounter()).
+extern thread_local atomic<uint64_t> nodes;
+
+
+
+// 'tbhits' is the number of successful tablebase probes of each search
+// thread, the total number is given by Threads::tbhits().
+extern thread_local atomic<uint64_t> tbhits;
+
+
+
+// bumpCounter
+//
+// Add to a counter of the calling thread (nodes or tbhits). Only the owner
+// thread writes its counters, so a relaxed load and store are enough, with
+// the cost of a plain increment, rather than an atomic read-modify-write.
+static inline void bumpCounter(atomic<uint64_t> &counter, uint64_t n = 1)
+{
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
 
 
 
@@ -130,11 +153,12 @@ extern std::map<std::string, int> Options;
 // These are flags to tell how the search is performed internally. These are not
 // to be confused with Limits, which are UCI-specific settings parsed in the
 // 'go' command. 
-extern uint64_t starttime;
-extern uint64_t stoptime;
-extern uint64_t inc;
-extern bool     timedout;
-extern bool     timeset;
+extern uint64_t     starttime;
+extern uint64_t     stoptime;
+extern atomic<bool> timedout;
+extern atomic<bool> pondering;
+extern atomic<bool> stopOnPonderhit;
+extern bool         timeset;
 
 
 
@@ -148,7 +172,7 @@ extern bool     timeset;
 // Note: storing exactly 2 killer moves is best for efficiency/performance.
 //
 // @see https://www.chessprogramming.org/Killer_Heuristic
-extern int killers[2][MaxPly];
+extern thread_local int killers[2][MaxPly];
 
 
 
@@ -158,7 +182,7 @@ extern int killers[2][MaxPly];
 // the score of previous searches. In other words, they have raised alpha.
 //
 // @see https://www.chessprogramming.org/History_Heuristic
-extern int history[12][64];
+extern thread_local int history[12][64];
 
 
 
@@ -192,22 +216,35 @@ extern int history[12][64];
 // propagated up to the root.
 //
 // @see https://www.chessprogramming.org/Triangular_PV-Table
-extern int pv_length[MaxPly];
+extern thread_local int pv_length[MaxPly];
 
 
 
 // PV table [ply][ply]
-extern int pv_table[MaxPly][MaxPly];
+extern thread_local int pv_table[MaxPly][MaxPly];
+
+
+
+// follow PV
+extern thread_local bool followPV;
 
 
 
-// follow PV & score PV move
-extern bool followPV, scorePV;
+// RootLine_t holds one of the PV lines reported at the root (see the MultiPV
+// option): its score and PV line at the last iteration completed, as well as
+// the aspiration window for the next iteration.
+typedef struct
+{
+    int score;
+    int alpha, beta;
+    int length;
+    int pv[MaxPly];
+} RootLine_t;
 
 
 
 // flag to control whether we allow null move pruning or not
-extern bool allowNull;
+extern thread_local bool allowNull;
 
 
 
@@ -256,35 +293,68 @@ static constexpr int mvv_lva[12][12] =
 
 // Functionality to search a position or perform an operation on the
 // nodes of a given position.
-void dperft(int);
-void search();
-int  qsearch(int, int);
-int  see(int);
+void dperft(Position_t &, int);
+void initPerftHash(int);
+void search(Position_t &);
+void stopSearch();
+void ponderhit();
+void helperSearch(Position_t &, int);
+int  analyzePosition(Position_t &, int, int &);
+int  qsearch(Position_t &, int, int);
+int  see(Position_t &, int);
 void initSearch();
-void sortMoves(MoveList_t &, int);
-void printMoveScores(MoveList_t &);
 void resetLimits();
 void resetTimeControl();
 
 
 
+// PerftEntry_t is an entry of the (optional) perft hash table, storing the
+// number of leaf nodes of a position searched to a given depth. The entry is
+// validated by XOR'ing the key with the data, so that concurrent perft
+// threads can share the table without locks.
+//
+// data = depth (8 bits) | nodes << 8
+typedef struct
+{
+    uint64_t key;
+    uint64_t data;
+} PerftEntry_t;
+
+
+
+// perft hash table (nullptr if disabled) and its size in entries - 1 (its
+// number of entries is a power of 2), see the "PerftHash" UCI option
+extern PerftEntry_t *perft_table;
+extern uint64_t perft_table_mask;
+
+
+
 // perft
 //
 // Verify move generation. All the leaf nodes up to the given depth are
 // generated and counted.
 // 
 // @see https://www.chessprogramming.org/Perft
-static inline void perft(int depth)
+static inline uint64_t perft(Position_t &pos, int depth)
 {
     // reliability checks
     assert(depth >= 0);
 
 
-    // escape at leaf nodes and increment node count
+    // escape at leaf nodes
     if (depth == 0)
+        return 1;
+
+
+    // look up the position in the perft hash table, if enabled
+    PerftEntry_t *entry = nullptr;
+    if (perft_table && (depth > 1))
     {
-        nodes++;
-        return;
+        entry = &perft_table[pos.hash_key & perft_table_mask];
+
+        uint64_t data = entry->data;
+        if (((entry->key ^ data) == pos.hash_key) && ((int)(data & 0xff) == depth))
+            return data >> 8;
     }
 
     
@@ -293,31 +363,42 @@ static inline void perft(int depth)
 
     
     // generate moves
-    generateMoves(MoveList);
+    generateMoves(pos, MoveList);
+
+
+    // all the moves generated are legal, so the leaf nodes one ply ahead can
+    // be counted without making the moves (bulk counting)
+    if (depth == 1)
+        return MoveList.count;
 
     
     // loop over generated moves
+    uint64_t count = 0ULL;
     for (int move_count = 0; move_count < MoveList.count; move_count++)
     {   
-        // preserve board state
-        saveBoard();
-
-
-        // make move and, if illegal, skip to the next move
-        if (!makeMove(MoveList.moves[move_count]))
-        {
-            takeBack();
-            continue;
-        }
+        // make move
+        makeMove(pos, MoveList.moves[move_count]);
 
 
         // call perft driver recursively
-        perft(depth - 1);
+        count += perft(pos, depth - 1);
 
         
         // undo move
-        takeBack();
+        takeBack(pos);
+    }
+
+
+    // store the result in the perft hash table
+    if (entry)
+    {
+        uint64_t data = (count << 8) | depth;
+        entry->data = data;
+        entry->key  = pos.hash_key ^ data;
     }
+
+
+    return count;
 }
 
 
@@ -326,62 +407,28 @@ static inline void perft(int depth)
          Move ordering
     =======================
     
-    1. PV move
-    2. Captures in MVV/LVA
-    3. Promotions
-    4. 1st killer move
-    5. 2nd killer move
-    6. History moves
-    7. Unsorted moves
+    1. Captures in MVV/LVA
+    2. Promotions
+    3. 1st killer move
+    4. 2nd killer move
+    5. History moves
+    6. Unsorted moves
+
+    Note: the search picks the moves in stages instead (TT and PV moves
+    first), see movepick.h.
 */
 
 // scoreMove
 //
 // Assign a score to a move.
-static inline int scoreMove(int move)
+static inline int scoreMove(Position_t &pos, int move)
 {
-    // if PV move scoring is allowed
-    // if PV move and scoring allowed, assign it the highest score
-    if (scorePV && (pv_table[0][ply] == move))
-    {
-        // disable score PV flag
-        scorePV = false;
-         
-        // give PV move the highest score to search it first
-        return 20000;
-    }
-
-
     // score capture move
-    else if (getMoveCapture(move))
+    if (getMoveCapture(move))
     {
-        // init target piece
-        int target_piece = P;
-        int toSq = getMoveTarget(move);
-
-        
-        // pick up bitboard piece index ranges depending on side
-        int start_piece = P, end_piece = K;
-        
-        if (sideToMove == White)
-        {
-            start_piece = p;
-            end_piece = k;
-        }
+        // the victim is on the target square, except for enpassant captures
+        int target_piece = getEp(move) ? P : pos.board[getMoveTarget(move)];
 
-        
-        // loop over the opponent's bitboards
-        for (int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
-        {
-            // if there's a piece on the target square
-            if (getBit(bitboards[bb_piece], toSq))
-            {
-                // remove it from corresponding bitboard
-                target_piece = bb_piece;
-                break;
-            }
-        }
-               
 
         // score move by MVV LVA lookup [source piece][target piece]
         return mvv_lva[getMovePiece(move)][target_piece] + 10000;
@@ -399,11 +446,11 @@ static inline int scoreMove(int move)
     else
     {
         // score 1st killer move
-        if (killers[0][ply] == move)
+        if (killers[0][pos.ply] == move)
             return 9000;
         
         // score 2nd killer move
-        else if (killers[1][ply] == move)
+        else if (killers[1][pos.ply] == move)
             return 8000;
         
         // score history move
@@ -418,30 +465,6 @@ static inline int scoreMove(int move)
 
 
 
-// enablePV_scoring
-//
-// Allow scoring PV moves.
-static inline void enablePV_scoring(MoveList_t &MoveList)
-{
-    // disable following PV
-    followPV = false;
-
-    
-    // loop over the moves within a move list
-    for (int count = 0; count < MoveList.count; count++)
-    {
-        // make sure we hit PV move
-        if (pv_table[0][ply] == MoveList.moves[count])
-        {
-            // enable move scoring and follow PV again
-            scorePV  = true;
-            followPV = true;
-        }
-    }
-}
-
-
-
 // getTimeInMilliseconds
 //
 // Get the number of milliseconds since epoch time.
@@ -452,110 +475,17 @@ static inline uint64_t getTimeInMilliseconds()
 
 
 
-// inputWaiting
-//
-// Function to "listen" to GUI's input during the search, without
-// blocking the program. Credit goes to Richard Albert, author of
-// VICE chess engine.
-static inline int inputWaiting()
-{
-    #ifndef WIN64
-
-        fd_set readfds;
-        struct timeval tv;
-        FD_ZERO (&readfds);
-        FD_SET (fileno(stdin), &readfds);
-        tv.tv_sec=0; tv.tv_usec=0;
-        select(16, &readfds, 0, 0, &tv);
-
-        return (FD_ISSET(fileno(stdin), &readfds));
-
-
-    #else
-
-        static int init = 0, pipe;
-        static HANDLE inh;
-        DWORD dw;
-
-        if (!init)
-        {
-            init = 1;
-            inh = GetStdHandle(STD_INPUT_HANDLE);
-            pipe = !GetConsoleMode(inh, &dw);
-            if (!pipe)
-            {
-                SetConsoleMode(inh, dw & ~(ENABLE_MOUSE_INPUT|ENABLE_WINDOW_INPUT));
-                FlushConsoleInputBuffer(inh);
-            }
-        }
-        
-        if (pipe)
-        {
-           if (!PeekNamedPipe(inh, NULL, 0, NULL, &dw, NULL)) return 1;
-           return dw;
-        }
-        
-        else
-        {
-           GetNumberOfConsoleInputEvents(inh, &dw);
-           return dw <= 1 ? 0 : dw;
-        }
-
-    #endif
-}
-
-
-
-// watchClockAndInput
-//
-// Check if we need to stop, because time is up, or because any other
-// limit has been hit.
-//
-// This function should be called in its own (asynchronous) thread, e.g.,
-// using launch::async with a future<> object.
-static inline void watchClockAndInput()
-{
-    string cmd;
-
-    
-    while (!timedout)
-    {
-        // watch clock
-        if (timeset && (getTimeInMilliseconds() > stoptime))
-            timedout = true;
-
-
-        // read the input
-        else if (inputWaiting())
-        {
-            cin >> cmd;
-            if (cmd == "stop")
-                timedout = true;
-        }
-
-        // check for nodes limitation
-        else if ((Limits.nodes > 0) && (nodes > Limits.nodes))
-            timedout = true;
-
-
-        // update interval 
-        this_thread::sleep_for(chrono::milliseconds(WatchIntervalMs));
-    }
-}
-
-
-
 // isEndgame
 //
 // Determine if the current position should be considered an endgame
 // position for the current side to move.
-static inline bool isEndgame()
+static inline bool isEndgame(Position_t &pos)
 {
-    int pawn_material   = countBits(bitboards[P] | bitboards[p]) * 100;
-    int knight_material = countBits(bitboards[N] | bitboards[n]) * 320;
-    int bishop_material = countBits(bitboards[B] | bitboards[b]) * 320;
-    int rook_material   = countBits(bitboards[R] | bitboards[r]) * 500;
-    int queen_material  = countBits(bitboards[Q] | bitboards[q]) * 950;
+    int pawn_material   = countBits(pos.bitboards[P] | pos.bitboards[p]) * 100;
+    int knight_material = countBits(pos.bitboards[N] | pos.bitboards[n]) * 320;
+    int bishop_material = countBits(pos.bitboards[B] | pos.bitboards[b]) * 320;
+    int rook_material   = countBits(pos.bitboards[R] | pos.bitboards[r]) * 500;
+    int queen_material  = countBits(pos.bitboards[Q] | pos.bitboards[q]) * 950;
 
 	return ((pawn_material + knight_material + bishop_material
                            + rook_material + queen_material) < 2600);
@@ -569,16 +499,16 @@ static inline bool isEndgame()
 // Determine the draw score based on the phase of the game and whose moving,
 // to encourge the engine to strive for a win in the middle-game, but be
 // satisified with a draw in the endgame.
-static inline int contempt()
+static inline int contempt(Position_t &pos)
 {
     // in the endgame, it's ok to try to draw, if we're losing
-    if (isEndgame())
+    if (isEndgame(pos))
         return DrawScore;
 
 
     // in the opening and middle game, we try to fight
     else
-        return ((sideToMove == White) ? -Options["Contempt"] : Options["Contempt"]);
+        return ((pos.sideToMove == White) ? -Options["Contempt"] : Options["Contempt"]);
 }
 
 
@@ -627,7 +557,7 @@ constexpr int futility_move_count(int depth)
 // getAttackers
 //
 // Create a Bitboard with all pieces from a given side attacking a given square.
-static inline Bitboard getAttackers(Side color, int sq, Bitboard occupied)
+static inline Bitboard getAttackers(Position_t &pos, Side color, int sq, Bitboard occupied)
 {
     // bitboards holding the attackers of different type
     Bitboard attackers = 0ULL;
@@ -641,12 +571,12 @@ static inline Bitboard getAttackers(Side color, int sq, Bitboard occupied)
 
 
     // get the basic list of attackers
-    attackingBishops = (color == White) ? bitboards[B] : bitboards[b];
-    attackingRooks   = (color == White) ? bitboards[R] : bitboards[r];
-    attackingQueens  = (color == White) ? bitboards[Q] : bitboards[q];
-    attackingKnights = (color == White) ? bitboards[N] : bitboards[n];
-    attackingKings   = (color == White) ? bitboards[K] : bitboards[k];
-    attackingPawns   = (color == White) ? bitboards[P] : bitboards[p];
+    attackingBishops = (color == White) ? pos.bitboards[B] : pos.bitboards[b];
+    attackingRooks   = (color == White) ? pos.bitboards[R] : pos.bitboards[r];
+    attackingQueens  = (color == White) ? pos.bitboards[Q] : pos.bitboards[q];
+    attackingKnights = (color == White) ? pos.bitboards[N] : pos.bitboards[n];
+    attackingKings   = (color == White) ? pos.bitboards[K] : pos.bitboards[k];
+    attackingPawns   = (color == White) ? pos.bitboards[P] : pos.bitboards[p];
 
 
     // add long-range attacks
@@ -673,16 +603,16 @@ static inline Bitboard getAttackers(Side color, int sq, Bitboard occupied)
 //
 // Find long-range attackers that attack a given square, in a given 
 // capturing sequence.
-static inline Bitboard considerXrays(int sq, Bitboard occupied)
+static inline Bitboard considerXrays(Position_t &pos, int sq, Bitboard occupied)
 {
     // start with an empty list (i.e., Bitboard) of attackers
     Bitboard attackers = 0ULL;
 
 
     // consider bishops, rooks and queens
-    Bitboard attackingBishops = bitboards[B] | bitboards[b];
-    Bitboard attackingRooks   = bitboards[R] | bitboards[r];
-    Bitboard attackingQueens  = bitboards[Q] | bitboards[q];
+    Bitboard attackingBishops = pos.bitboards[B] | pos.bitboards[b];
+    Bitboard attackingRooks   = pos.bitboards[R] | pos.bitboards[r];
+    Bitboard attackingQueens  = pos.bitboards[Q] | pos.bitboards[q];
 
 
     // add attacks from each long-range piece
@@ -702,7 +632,7 @@ static inline Bitboard considerXrays(int sq, Bitboard occupied)
 // minAttacker
 //
 // Reveal the next (least valuable) attacker in a capturing sequence.
-static inline Bitboard minAttacker(Bitboard attadef, int stm, int &attacker)
+static inline Bitboard minAttacker(Position_t &pos, Bitboard attadef, int stm, int &attacker)
 {
     // decide what pieces to look for, depending on the side to move
     int start_piece = P, end_piece = K;
@@ -717,7 +647,7 @@ static inline Bitboard minAttacker(Bitboard attadef, int stm, int &attacker)
     // loop through the pieces to find the next attacker
     for (attacker = start_piece; attacker <= end_piece; attacker++)
     {
-	    Bitboard subset = attadef & bitboards[attacker];
+	    Bitboard subset = attadef & pos.bitboards[attacker];
 
         if (subset)
             return (subset & -subset);
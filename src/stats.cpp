@@ -0,0 +1,163 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#include <cstring>
+
+#include "stats.h"
+
+
+
+using namespace std;
+
+
+
+// Counters of the current thread
+thread_local uint64_t Stats::counters[StatCount];
+
+
+
+// Counters of all the search threads
+static vector<uint64_t *> registry;
+static mutex registryMutex;
+
+
+
+// Name of every counter, in the same order as the Stat enum
+#ifdef USE_STATS
+static const char *StatNames[StatCount] =
+{
+    "nodes", "qnodes", "qsearch max ply",
+    "tt probes", "tt hits", "tt cutoffs",
+    "razoring", "reverse futility", "null move tried", "null move cutoffs",
+    "futility pruned", "late move pruned",
+    "lmr reductions", "lmr re-searches", "pvs re-searches",
+    "beta cutoffs", "moves before cutoff", "first move cutoffs"
+};
+#endif
+
+
+
+// Stats::attach
+//
+// Register the counters of the calling thread.
+void Stats::attach()
+{
+    lock_guard<mutex> lock(registryMutex);
+
+    memset(counters, 0, sizeof(counters));
+    registry.push_back(counters);
+}
+
+
+
+// Stats::detach
+//
+// Unregister the counters of the calling thread, e.g., before it exits.
+void Stats::detach()
+{
+    lock_guard<mutex> lock(registryMutex);
+
+    registry.erase(remove(registry.begin(), registry.end(), counters), registry.end());
+}
+
+
+
+// Stats::clear
+//
+// Reset the counters of all the threads. This must be done when the threads
+// are not searching (i.e., at the beginning of a new search).
+void Stats::clear()
+{
+    lock_guard<mutex> lock(registryMutex);
+
+    for (uint64_t *c : registry)
+        memset(c, 0, StatCount * sizeof(uint64_t));
+}
+
+
+
+// Stats::print
+//
+// Print the counters of the last search, added up for all the threads (the
+// maximum qsearch ply is the maximum of all threads). Each counter is printed
+// in its own line, as an "info string" line if requested (e.g., for a GUI),
+// or as a table with the percentages otherwise.
+void Stats::print(bool info)
+{
+#ifndef USE_STATS
+    cout << (info ? "info string " : "") << "Search statistics are disabled, build with: make STATS=yes"
+         << endl << flush;
+
+#else
+    uint64_t total[StatCount] = { 0 };
+
+
+    // add up the counters of all the threads
+    {
+        lock_guard<mutex> lock(registryMutex);
+
+        for (uint64_t *c : registry)
+            for (int s = 0; s < StatCount; s++)
+                total[s] = (s == StatQSearchMaxPly) ? std::max(total[s], c[s]) : total[s] + c[s];
+    }
+
+
+    // percentage of a counter relative to another one
+    auto percent = [&](int s, int base) { return total[base] ? 100.0 * total[s] / total[base] : 0.0; };
+
+
+    for (int s = 0; s < StatCount; s++)
+    {
+        // relative figure of the counter, if any
+        int base = -1;
+
+        switch (s)
+        {
+            case StatTTHits:           base = StatTTProbes;    break;
+            case StatTTCutoffs:        base = StatTTProbes;    break;
+            case StatNullCutoffs:      base = StatNullTried;   break;
+            case StatLMRReSearches:    base = StatLMR;         break;
+            case StatFirstMoveCutoffs: base = StatBetaCutoffs; break;
+            default:                                           break;
+        }
+
+
+        if (info)
+            cout << "info string stats " << StatNames[s] << " " << total[s];
+        else
+            cout << setw(20) << left << StatNames[s] << right << setw(14) << total[s];
+
+        if (base >= 0)
+            cout << fixed << setprecision(1) << " (" << percent(s, base) << "%)";
+
+        if ((s == StatCutoffMoves) && total[StatBetaCutoffs])
+            cout << fixed << setprecision(2) << " (" << (double)total[s] / total[StatBetaCutoffs] << " per cutoff)";
+
+        cout << endl;
+    }
+
+    cout << resetiosflags(cout.flags()) << flush;
+
+#endif
+}
@@ -0,0 +1,88 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <algorithm>
+
+
+
+// Search statistics (compile with "make STATS=yes" to enable them)
+//
+// The counters below record how often the different parts of the search
+// fire: TT hits, forward pruning, reductions, beta cutoffs, etc. They are
+// meant for tuning the search with data. When USE_STATS is not defined, the
+// STAT_*() macros expand to nothing, so they have zero cost in the release
+// builds.
+enum Stat
+{
+    // nodes
+    StatNodes, StatQNodes, StatQSearchMaxPly,
+
+    // transposition table
+    StatTTProbes, StatTTHits, StatTTCutoffs,
+
+    // forward pruning
+    StatRazoring, StatRFP, StatNullTried, StatNullCutoffs,
+    StatFutility, StatLMP,
+
+    // reductions and re-searches
+    StatLMR, StatLMRReSearches, StatPVSReSearches,
+
+    // beta cutoffs, and number of moves searched before them
+    StatBetaCutoffs, StatCutoffMoves, StatFirstMoveCutoffs,
+
+    StatCount
+};
+
+
+
+#ifdef USE_STATS
+    #define STAT_INC(s)      (Stats::counters[s]++)
+    #define STAT_ADD(s, n)   (Stats::counters[s] += (n))
+    #define STAT_MAX(s, n)   (Stats::counters[s] = std::max<uint64_t>(Stats::counters[s], (n)))
+#else
+    #define STAT_INC(s)      ((void)0)
+    #define STAT_ADD(s, n)   ((void)0)
+    #define STAT_MAX(s, n)   ((void)0)
+#endif
+
+
+
+// Every search thread keeps its own counters (thread_local), and registers
+// them with attach() so that they can be reset and added up for all the
+// threads. The counters are reset at the beginning of every search.
+namespace Stats
+{
+
+extern thread_local uint64_t counters[StatCount];
+
+void attach();
+void detach();
+void clear();
+void print(bool);
+
+}  //  namespace Stats
+
+
+
+#endif  //  STATS_H
@@ -0,0 +1,260 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+
+#include "bitboard.h"
+#include "position.h"
+#include "movgen.h"
+#include "search.h"
+#include "tb.h"
+#include "tbprobe.h"
+#include "thread.h"
+
+
+
+using namespace std;
+
+
+
+// Root moves allowed by the tablebases (i.e., those preserving the best
+// result), or an empty list if the root position is not in the tablebases.
+static MoveList_t rootMoves = { {}, 0 };
+
+
+
+// tbBitboard
+//
+// Fathom uses the a1=0 (little-endian rank-file) square mapping, whereas
+// Gargantua uses a8=0; converting between them is a vertical flip.
+static inline Bitboard tbBitboard(Bitboard bb)
+{
+    return __builtin_bswap64(bb);
+}
+
+
+
+// TB::init
+//
+// Load the tablebases found in the given path (several directories can
+// be given, separated by ':', or ';' on Windows). An empty path (or
+// "<empty>") disables the tablebases.
+void TB::init(const string &path)
+{
+    // free the tablebases loaded so far
+    TB::free();
+
+
+    // no tablebases configured
+    if (path.empty() || (path == "<empty>"))
+        return;
+
+
+    // load them and tell the GUI how many men are available
+    if (!tb_init(path.c_str()) || !TB_LARGEST)
+        cout << "info string No Syzygy tablebases found in " << path << endl << flush;
+    else
+        cout << "info string Syzygy tablebases loaded: up to " << TB_LARGEST << " men" << endl << flush;
+}
+
+
+
+// TB::free
+//
+// Free the tablebases loaded, if any.
+void TB::free()
+{
+    tb_free();
+    rootMoves.count = 0;
+}
+
+
+
+// TB::largest
+//
+// Return the maximum number of men in the tablebases loaded (0 if none).
+int TB::largest()
+{
+    return TB_LARGEST;
+}
+
+
+
+// TB::canProbe
+//
+// True if the position can be found in the tablebases: there must be few
+// enough pieces on the board, and no castling rights.
+bool TB::canProbe(Position_t &pos)
+{
+    return TB_LARGEST && !pos.castle && (countBits(pos.occupancies[Both]) <= TB_LARGEST);
+}
+
+
+
+// TB::probeWDL
+//
+// Probe the Win-Draw-Loss tables for the current position. Only positions
+// right after a capture or a pawn move (fifty = 0) can be probed. Return
+// false if the probe fails, otherwise return true and set the score of the
+// position from the point of view of the side to move.
+int TB::probeWDL(Position_t &pos, int &score)
+{
+    // probe the WDL tables
+    unsigned wdl = tb_probe_wdl(tbBitboard(pos.occupancies[White]),
+                                tbBitboard(pos.occupancies[Black]),
+                                tbBitboard(pos.bitboards[K] | pos.bitboards[k]),
+                                tbBitboard(pos.bitboards[Q] | pos.bitboards[q]),
+                                tbBitboard(pos.bitboards[R] | pos.bitboards[r]),
+                                tbBitboard(pos.bitboards[B] | pos.bitboards[b]),
+                                tbBitboard(pos.bitboards[N] | pos.bitboards[n]),
+                                tbBitboard(pos.bitboards[P] | pos.bitboards[p]),
+                                (pos.epsq == NoSq) ? 0 : (pos.epsq ^ 56),
+                                pos.sideToMove == White);
+
+    if (wdl == TB_RESULT_FAILED)
+        return false;
+
+
+    // wins and losses under the 50-move rule are scored as draws, but they
+    // are preferred to (or avoided against) plain draws
+    switch (wdl)
+    {
+        case TB_WIN:          score =  TBWinScore - pos.ply; break;
+        case TB_LOSS:         score = -TBWinScore + pos.ply; break;
+        case TB_CURSED_WIN:   score =  DrawScore + 1;        break;
+        case TB_BLESSED_LOSS: score =  DrawScore - 1;        break;
+        default:              score =  DrawScore;            break;
+    }
+
+
+    return true;
+}
+
+
+
+// TB::filterRootMoves
+//
+// Rank the root moves with the DTZ tables (or with the WDL tables, if the DTZ
+// tables are missing), and keep only the moves preserving the best result,
+// so that the search only chooses among them. The list is left empty if the
+// root position is not in the tablebases.
+void TB::filterRootMoves(Position_t &pos)
+{
+    // no filter by default
+    rootMoves.count = 0;
+
+    if (!canProbe(pos))
+        return;
+
+
+    // rank the root moves
+    static TbRootMoves results;
+
+    Bitboard white   = tbBitboard(pos.occupancies[White]);
+    Bitboard black   = tbBitboard(pos.occupancies[Black]);
+    Bitboard kings   = tbBitboard(pos.bitboards[K] | pos.bitboards[k]);
+    Bitboard queens  = tbBitboard(pos.bitboards[Q] | pos.bitboards[q]);
+    Bitboard rooks   = tbBitboard(pos.bitboards[R] | pos.bitboards[r]);
+    Bitboard bishops = tbBitboard(pos.bitboards[B] | pos.bitboards[b]);
+    Bitboard knights = tbBitboard(pos.bitboards[N] | pos.bitboards[n]);
+    Bitboard pawns   = tbBitboard(pos.bitboards[P] | pos.bitboards[p]);
+    unsigned ep      = (pos.epsq == NoSq) ? 0 : (pos.epsq ^ 56);
+    bool     turn    = (pos.sideToMove == White);
+
+    if (   !tb_probe_root_dtz(white, black, kings, queens, rooks, bishops, knights, pawns,
+                              pos.fifty, ep, turn, isRepetition(pos), true, &results)
+        && !tb_probe_root_wdl(white, black, kings, queens, rooks, bishops, knights, pawns,
+                              pos.fifty, ep, turn, true, &results))
+        return;
+
+    if (results.size == 0)
+        return;
+
+
+    // best rank among all the root moves
+    int bestRank = results.moves[0].tbRank;
+    for (unsigned i = 1; i < results.size; i++)
+        bestRank = std::max(bestRank, results.moves[i].tbRank);
+
+
+    // translate the best moves into Gargantua moves
+    MoveList_t MoveList;
+    generateMoves(pos, MoveList);
+
+    for (unsigned i = 0; i < results.size; i++)
+    {
+        if (results.moves[i].tbRank != bestRank)
+            continue;
+
+        PyrrhicMove tbMove = results.moves[i].move;
+        int fromSq   = ((tbMove >> 6) & 0x3f) ^ 56;
+        int toSq     = (tbMove & 0x3f) ^ 56;
+        int promotes = (tbMove >> 12) & 0x07;
+
+        for (int count = 0; count < MoveList.count; count++)
+        {
+            int move  = MoveList.moves[count];
+            int promo = getPromo(move);
+
+            // Fathom promotions: 1 = Queen, 2 = Rook, 3 = Bishop, 4 = Knight
+            int tbPromo = 0;
+            if (promo)
+                tbPromo = (promo % 6 == Q) ? 1 : (promo % 6 == R) ? 2 : (promo % 6 == B) ? 3 : 4;
+
+            if ((getMoveSource(move) == fromSq) && (getMoveTarget(move) == toSq) && (tbPromo == promotes))
+                addMove(rootMoves, move);
+        }
+    }
+
+
+    // tell the GUI about the tablebase filter (through the writer thread, as
+    // the rest of the search output)
+    Threads::send("info string Syzygy tablebases: " + to_string(rootMoves.count)
+                  + " root moves preserve the best result\n");
+}
+
+
+
+// TB::clearRootMoves
+//
+// Forget the root moves filtered by the last search, so that any move is
+// allowed at the root (e.g., for searches not started by search()).
+void TB::clearRootMoves()
+{
+    rootMoves.count = 0;
+}
+
+
+
+// TB::isRootMove
+//
+// True if the search may choose the given move at the root, according to the
+// tablebases (any move is allowed if the root is not in the tablebases).
+bool TB::isRootMove(int move)
+{
+    if (!rootMoves.count)
+        return true;
+
+    for (int count = 0; count < rootMoves.count; count++)
+        if (rootMoves.moves[count] == move)
+            return true;
+
+    return false;
+}
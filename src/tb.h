@@ -0,0 +1,63 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TB_H
+#define TB_H
+
+#include <string>
+
+#include "bitboard.h"
+#include "position.h"
+#include "movgen.h"
+
+
+
+// Score of a position won according to the tablebases, from the point of
+// view of the side to move (minus the distance to the root). It's lower than
+// any mate score, and it fits in the 16 bits of a TT entry.
+#define TBWinScore   30000
+
+
+
+// Syzygy endgame tablebases, probed through Fathom (tbprobe.cpp).
+//
+// The tablebase files are memory-mapped (read-only) the first time they are
+// probed, so they live in the page cache of the OS, which is shared by all
+// the search threads (and processes), and it's paged out under memory
+// pressure instead of exhausting the RAM with large 6-man and 7-man sets.
+//
+// @see https://www.chessprogramming.org/Syzygy_Bases
+namespace TB
+{
+
+void init(const std::string &);
+void free();
+int  largest();
+bool canProbe(Position_t &);
+int  probeWDL(Position_t &, int &);
+void filterRootMoves(Position_t &);
+void clearRootMoves();
+bool isRootMove(int);
+
+}  //  namespace TB
+
+
+
+#endif  //  TB_H
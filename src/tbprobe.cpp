@@ -206,6 +206,10 @@ static void *map_file(FD fd, map_t *mapping)
     perror("mmap");
     return NULL;
   }
+#ifdef MADV_RANDOM
+  // probes are scattered all over the file, so don't read ahead
+  madvise(data, statbuf.st_size, MADV_RANDOM);
+#endif
 #else
   DWORD size_low, size_high;
   size_low = GetFileSize(fd, &size_high);
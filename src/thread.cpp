@@ -0,0 +1,491 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "bitboard.h"
+#include "position.h"
+#include "search.h"
+#include "thread.h"
+#include "stats.h"
+
+
+
+using namespace std;
+
+
+
+// Helper threads and the synchronization primitives to wake them up when a
+// new search starts, and to wait for them to finish.
+static vector<thread>     helpers;
+static mutex              mtx;
+static condition_variable cv;
+static int                searchId = 0;
+static int                running  = 0;
+static bool               quitting = false;
+
+
+
+// Root position handed over to the helper threads
+static Position_t *root = nullptr;
+
+
+
+// Node counters of all the threads (the main thread's counter goes first):
+// each thread counts its own nodes in its thread_local 'nodes' variable.
+static vector<atomic<uint64_t> *> counters(1, nullptr);
+
+
+
+// Tablebase hit counters of all the threads, in the same order as 'counters'.
+static vector<atomic<uint64_t> *> hits(1, nullptr);
+
+
+
+// Main search thread, which runs search() in the background when the UCI
+// loop receives "go", so that the UCI loop keeps reading commands (e.g.,
+// "stop" or "isready") during the search. It's created with the first search
+// and then it sleeps between searches.
+static thread             searcher;
+static mutex              searchMtx;
+static condition_variable searchCv;
+static Position_t        *searchPos      = nullptr;
+static bool               searching      = false;
+static bool               searcherQuit   = false;
+
+
+
+// Writer thread, which writes the output of the search to stdout. The lines
+// sent are appended to 'outputQueue' (its buffer is kept between searches),
+// and the writer writes all the lines queued at once. It's created with the
+// first line sent.
+#define OutputBufferSize 65536
+
+static thread             writer;
+static mutex              outputMtx;
+static condition_variable outputCv;
+static string             outputQueue;
+static bool               writing        = false;
+static bool               writerQuit     = false;
+
+
+
+// writeLoop
+//
+// Entry point of the writer thread: sleep until some output is sent, write it
+// and go back to sleep. The output queued is written before quitting.
+static void writeLoop()
+{
+    string pending;
+    pending.reserve(OutputBufferSize);
+
+
+    unique_lock<mutex> lock(outputMtx);
+
+    while (true)
+    {
+        outputCv.wait(lock, [] { return !outputQueue.empty() || writerQuit; });
+
+        if (outputQueue.empty())
+            break;
+
+
+        // write the output without holding the lock, so that the search can
+        // keep sending lines in the meantime
+        swap(pending, outputQueue);
+        writing = true;
+        lock.unlock();
+
+        fwrite(pending.data(), 1, pending.size(), stdout);
+        fflush(stdout);
+        pending.clear();
+
+        lock.lock();
+
+
+        // tell flushOutput() the output is written
+        writing = false;
+        outputCv.notify_all();
+    }
+}
+
+
+
+// searchLoop
+//
+// Entry point of the main search thread: sleep until a new search is started
+// by startSearch(), search its position and go back to sleep.
+static void searchLoop()
+{
+    // register this thread's search statistics
+    Stats::attach();
+
+
+    unique_lock<mutex> lock(searchMtx);
+
+    while (true)
+    {
+        searchCv.wait(lock, [] { return searching || searcherQuit; });
+
+        if (searcherQuit)
+            break;
+
+
+        // search the position given, without holding the lock, so that
+        // waitSearch() can be called in the meantime
+        lock.unlock();
+        search(*searchPos);
+        lock.lock();
+
+
+        // tell waitSearch() the search is over
+        searching = false;
+        searchCv.notify_all();
+    }
+
+
+    Stats::detach();
+}
+
+
+
+// idleLoop
+//
+// Entry point of every helper thread: sleep until a new search starts, then
+// search the root position, tell the main thread we are done and go back to
+// sleep.
+static void idleLoop(int id)
+{
+    // the last search seen by this thread
+    int seen = 0;
+
+
+    // position searched by this thread, allocated on the heap as it is large
+    Position_t *pos = new Position_t;
+
+
+    // register this thread's search statistics
+    Stats::attach();
+
+
+    // register this thread's node counter, and wait for the first search
+    unique_lock<mutex> lock(mtx);
+    counters[id] = &nodes;
+    hits[id]     = &tbhits;
+    cv.notify_all();
+
+
+    while (true)
+    {
+        cv.wait(lock, [&] { return quitting || (searchId != seen); });
+
+        if (quitting)
+        {
+            Stats::detach();
+            delete pos;
+            return;
+        }
+
+        seen = searchId;
+        lock.unlock();
+
+
+        // search a copy of the root position
+        *pos = *root;
+        helperSearch(*pos, id);
+
+
+        // report back to the main thread
+        lock.lock();
+        if (--running == 0)
+            cv.notify_all();
+    }
+}
+
+
+
+// Threads::init
+//
+// (Re)create the pool, so that a total of n threads (the main one included)
+// take part in the search.
+void Threads::init(int n)
+{
+    // reliability checks
+    assert(n >= 1);
+
+
+    // terminate the current helper threads
+    Threads::exit();
+
+
+    // spawn the helper threads and wait until they are ready
+    unique_lock<mutex> lock(mtx);
+    quitting = false;
+    counters.assign(n, nullptr);
+    hits.assign(n, nullptr);
+
+    for (int id = 1; id < n; id++)
+        helpers.emplace_back(idleLoop, id);
+
+    cv.wait(lock, [&] { return all_of(counters.begin() + 1, counters.end(),
+                                      [](atomic<uint64_t> *c) { return c != nullptr; }); });
+}
+
+
+
+// Threads::exit
+//
+// Terminate all the helper threads. This must be done before the program
+// exits.
+void Threads::exit()
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        quitting = true;
+    }
+
+    cv.notify_all();
+
+    for (thread &t : helpers)
+        t.join();
+
+    helpers.clear();
+    counters.assign(1, nullptr);
+    hits.assign(1, nullptr);
+}
+
+
+
+// Threads::count
+//
+// Return the total number of threads taking part in the search.
+int Threads::count()
+{
+    return helpers.size() + 1;
+}
+
+
+
+// Threads::startHelpers
+//
+// Wake up the helper threads to search the given position. The calling
+// thread becomes the main thread of the search, and it must not change the
+// position until the helpers are done (see waitHelpers()).
+void Threads::startHelpers(Position_t &pos)
+{
+    lock_guard<mutex> lock(mtx);
+
+
+    // hand over the root position, and reset all node (and tbhits) counters
+    root = &pos;
+    counters[0] = &::nodes;
+    hits[0]     = &::tbhits;
+
+    for (atomic<uint64_t> *c : counters)
+        c->store(0ULL, memory_order_relaxed);
+
+    for (atomic<uint64_t> *c : hits)
+        c->store(0ULL, memory_order_relaxed);
+
+
+    // start the new search
+    running = helpers.size();
+    searchId++;
+    cv.notify_all();
+}
+
+
+
+// Threads::waitHelpers
+//
+// Wait until all the helper threads have finished their search. The stop
+// signal (timedout) must have been set before calling this function.
+void Threads::waitHelpers()
+{
+    unique_lock<mutex> lock(mtx);
+    cv.wait(lock, [] { return running == 0; });
+}
+
+
+
+// Threads::nodes
+//
+// Return the total number of nodes searched by all the threads.
+uint64_t Threads::nodes()
+{
+    uint64_t total = 0ULL;
+
+
+    for (atomic<uint64_t> *c : counters)
+        if (c)
+            total += c->load(memory_order_relaxed);
+
+
+    return total;
+}
+
+
+
+// Threads::tbhits
+//
+// Return the total number of tablebase hits of all the threads.
+uint64_t Threads::tbhits()
+{
+    uint64_t total = 0ULL;
+
+
+    for (atomic<uint64_t> *c : hits)
+        if (c)
+            total += c->load(memory_order_relaxed);
+
+
+    return total;
+}
+
+
+
+// Threads::startSearch
+//
+// Start searching a copy of the given position in the background, using the
+// current Limits, and return immediately. The search stops by itself (it
+// prints "bestmove" when done), or when the 'timedout' flag is set.
+void Threads::startSearch(Position_t &pos)
+{
+    // wait for the previous search, if any
+    Threads::waitSearch();
+
+
+    // create the main search thread with the first search
+    if (!searcher.joinable())
+    {
+        searchPos    = new Position_t;
+        searcherQuit = false;
+        searcher     = thread(searchLoop);
+    }
+
+
+    // hand over the position and wake up the main search thread
+    lock_guard<mutex> lock(searchMtx);
+    *searchPos = pos;
+    searching  = true;
+    searchCv.notify_all();
+}
+
+
+
+// Threads::waitSearch
+//
+// Wait until the search started by startSearch() (if any) is over and its
+// output has been written, so that any output after it comes in order.
+void Threads::waitSearch()
+{
+    {
+        unique_lock<mutex> lock(searchMtx);
+        searchCv.wait(lock, [] { return !searching; });
+    }
+
+    Threads::flushOutput();
+}
+
+
+
+// Threads::shutdown
+//
+// Stop the current search (if any), and terminate the main search thread and
+// the helper threads. This must be done before the program exits.
+void Threads::shutdown()
+{
+    // stop the search and wait for it
+    stopSearch();
+    Threads::waitSearch();
+
+
+    // terminate the main search thread
+    if (searcher.joinable())
+    {
+        {
+            lock_guard<mutex> lock(searchMtx);
+            searcherQuit = true;
+        }
+
+        searchCv.notify_all();
+        searcher.join();
+
+        delete searchPos;
+        searchPos = nullptr;
+    }
+
+
+    // terminate the helper threads
+    Threads::exit();
+
+
+    // terminate the writer thread, once all the output is written
+    if (writer.joinable())
+    {
+        {
+            lock_guard<mutex> lock(outputMtx);
+            writerQuit = true;
+        }
+
+        outputCv.notify_all();
+        writer.join();
+    }
+}
+
+
+
+// Threads::send
+//
+// Queue some output (one or more full lines) to be written to stdout by the
+// writer thread, and return immediately.
+void Threads::send(const string &text)
+{
+    lock_guard<mutex> lock(outputMtx);
+
+
+    // create the writer thread with the first output
+    if (!writer.joinable())
+    {
+        outputQueue.reserve(OutputBufferSize);
+        writerQuit = false;
+        writer     = thread(writeLoop);
+    }
+
+
+    outputQueue += text;
+    outputCv.notify_all();
+}
+
+
+
+// Threads::flushOutput
+//
+// Wait until all the output sent with send() has been written.
+void Threads::flushOutput()
+{
+    unique_lock<mutex> lock(outputMtx);
+    outputCv.wait(lock, [] { return outputQueue.empty() && !writing; });
+}
@@ -0,0 +1,70 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <cstdint>
+#include <string>
+
+#include "bitboard.h"
+#include "position.h"
+
+
+
+// Lazy SMP thread pool.
+//
+// The main thread (the one calling search()) is helped by Threads - 1 helper
+// threads, which are created once and then sleep between searches. When a
+// search starts, every helper receives a copy of the root position and runs
+// helperSearch() on its own position and search stacks (thread_local), until
+// the main thread stops the search. The threads only share the transposition
+// table.
+//
+// The UCI "go" command runs the main thread of the search in the background
+// (see startSearch()), so that the UCI loop can handle "stop", "isready",
+// etc. during the search.
+//
+// The output of the search ("info" and "bestmove" lines) is handed over to
+// a writer thread (see send()), so that the search doesn't wait for the GUI
+// to read its output when the pipe is full or slow.
+//
+// @see https://www.chessprogramming.org/Lazy_SMP
+namespace Threads
+{
+
+void init(int);
+void exit();
+int count();
+void startHelpers(Position_t &);
+void waitHelpers();
+uint64_t nodes();
+uint64_t tbhits();
+void startSearch(Position_t &);
+void waitSearch();
+void shutdown();
+void send(const std::string &);
+void flushOutput();
+
+}  //  namespace Threads
+
+
+
+#endif  //  THREAD_H
@@ -0,0 +1,185 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+
+#include "search.h"
+#include "timeman.h"
+
+
+
+// Optimum and maximum time of the current move (in milliseconds), and
+// whether they are managed dynamically (i.e., playing on the clock).
+static uint64_t optimumTime = 0;
+static uint64_t maximumTime = 0;
+static bool     managed     = false;
+
+
+
+// Best move of the last iteration, number of consecutive iterations it has
+// been the best move, and time elapsed when the last iterations finished.
+static int      lastBestMove  = 0;
+static int      stability     = 0;
+static uint64_t lastIteration = 0;
+static uint64_t iterationTime = 0;
+
+
+
+// Scale (per cent) of the optimum time, indexed by the stability of the best
+// move: unstable best moves get more time, stable ones less.
+static const int TimeStabilityScale[TimeStabilityMax + 1] = { 250, 120, 90, 80, 75 };
+
+
+
+// Time::init
+//
+// Set up the time limits for the search of the given side to move, from the
+// Limits parsed in the "go" command. Note that this must be called right after
+// resetTimeControl(), once the "go" command is parsed, and it only sets up a
+// time control when the search is not infinite.
+void Time::init(int side)
+{
+    int64_t overhead = Options["Move Overhead"];
+    int64_t time     = (side == White) ? Limits.wtime : Limits.btime;
+    int64_t incr     = (side == White) ? Limits.winc  : Limits.binc;
+
+
+    // forget about the previous search
+    managed       = false;
+    lastBestMove  = 0;
+    stability     = 0;
+    lastIteration = 0;
+    iterationTime = 0;
+
+
+    // no time control: search until "stop", or until the depth or nodes
+    // limits are reached
+    if (Limits.infinite || (!Limits.movetime && (time <= 0)))
+        return;
+
+
+    // fixed time per move: only compensate for the lag
+    if (Limits.movetime)
+    {
+        optimumTime = Limits.movetime;
+
+        if (optimumTime > 10 * (uint64_t)overhead)
+            optimumTime -= overhead;
+
+        maximumTime = optimumTime;
+    }
+
+
+    // playing on the clock: spread the remaining time (plus the increments
+    // to come) over the moves to go, keeping a safety margin for the lag
+    else
+    {
+        int64_t mtg  = Limits.movestogo ? std::min(Limits.movestogo, TimeMovesMax) : TimeMovesHorizon;
+        int64_t safe = std::max<int64_t>(time - overhead, 1);
+        int64_t left = safe + incr * (mtg - 1);
+
+
+        // the last move before the time control may use the whole clock,
+        // otherwise always leave some time for the next moves
+        maximumTime = (mtg == 1) ? safe : std::max<int64_t>(safe * TimeMaxShare / 100, 1);
+        optimumTime = std::min<uint64_t>(left / mtg, maximumTime);
+        maximumTime = std::min<uint64_t>(optimumTime * TimeMaxRatio, maximumTime);
+
+        managed = true;
+    }
+
+
+    // the hard limit is checked by the search itself (see checkLimits())
+    timeset  = true;
+    stoptime = starttime + maximumTime;
+}
+
+
+
+// Time::iterationDone
+//
+// Tell the time manager that an iteration of the iterative deepening has
+// finished with the given best move, and return whether the search should
+// stop now, rather than starting the next iteration.
+bool Time::iterationDone(int bestMove)
+{
+    uint64_t now = Time::elapsed();
+
+
+    // keep track of the time taken by the last iteration, to guess how long
+    // the next one is going to take
+    iterationTime = now - lastIteration;
+    lastIteration = now;
+
+
+    // keep track of the stability of the best move
+    if (bestMove == lastBestMove)
+        stability = std::min(stability + 1, TimeStabilityMax);
+    else
+        stability = 0;
+
+    lastBestMove = bestMove;
+
+
+    // with a fixed time per move, only the hard limit stops the search
+    if (!managed)
+        return false;
+
+
+    // stop if the (scaled) optimum time is used up
+    if (now >= optimumTime * TimeStabilityScale[stability] / 100)
+        return true;
+
+
+    // don't start an iteration that won't finish in time: each iteration
+    // usually takes about twice as long as the previous one
+    return (now + 2 * iterationTime > maximumTime);
+}
+
+
+
+// Time::elapsed
+//
+// Return the time elapsed since the search started (in milliseconds).
+uint64_t Time::elapsed()
+{
+    return getTimeInMilliseconds() - starttime;
+}
+
+
+
+// Time::optimum
+//
+// Return the optimum time (soft limit) of the current move.
+uint64_t Time::optimum()
+{
+    return optimumTime;
+}
+
+
+
+// Time::maximum
+//
+// Return the maximum time (hard limit) of the current move.
+uint64_t Time::maximum()
+{
+    return maximumTime;
+}
@@ -0,0 +1,70 @@
+/*
+  This file is part of Gargantua, a UCI chess engine with NNUE evaluation
+  derived from Chess0, and inspired by Code Monkey King's bbc-1.4.
+     
+  Copyright (C) 2024 Claudio M. Camacho
+ 
+  Gargantua is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+ 
+  Gargantua is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TIMEMAN_H
+#define TIMEMAN_H
+
+#include <cstdint>
+
+
+
+// Time management settings
+//
+// TimeMovesHorizon is the number of moves the remaining time is spread over
+// when there's no "movestogo" (sudden death, with or without increment), and
+// TimeMovesMax caps "movestogo" for long time controls. The maximum time of
+// a move is TimeMaxRatio times its optimum time (but never more than
+// TimeMaxShare per cent of the clock). The optimum time is scaled by
+// TimeStabilityScale[] (per cent), indexed by the number of iterations the
+// best move has not changed.
+#define TimeMovesHorizon          40
+#define TimeMovesMax              50
+#define TimeMaxRatio               5
+#define TimeMaxShare              75
+#define TimeStabilityMax           4
+
+
+
+// Time manager of the search.
+//
+// When the engine plays on the clock ("go wtime/btime ..."), the time
+// allocated to a move has a soft limit (the optimum time) and a hard limit
+// (the maximum time). The hard limit stops the search anywhere (stoptime),
+// whereas the soft limit is checked only after every iteration of the
+// iterative deepening: the search stops earlier when the best move has been
+// stable for a few iterations, and it takes longer when it keeps changing.
+// A new iteration is not started if it's not expected to finish in time.
+//
+// With "go movetime", the search simply stops after the time given.
+namespace Time
+{
+
+void     init(int);
+bool     iterationDone(int);
+uint64_t elapsed();
+uint64_t optimum();
+uint64_t maximum();
+
+}  //  namespace Time
+
+
+
+#endif  //  TIMEMAN_H
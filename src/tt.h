@@ -21,6 +21,9 @@
 #ifndef TT_H
 #define TT_H
 
+#include "bitboard.h"
+#include "position.h"
+
 
 
 // Zobrist hash keys for a given chess position. Every position includes:
@@ -38,16 +41,11 @@ extern Bitboard side_key;
 // Transposition Table implementation:
 //
 // We use a C-stye array due to a much faster speed in read and
-// write performance. The array contains TTEntry objects, which
-// take 144 bits of space each (18 bytes).
+// write performance. The array is made of buckets (TTBucket_t) of the size
+// of a cache line (64 bytes), each of them holding 6 compact entries of 10
+// bytes (TTEntry_t). A probe thus costs a single cache miss at most.
 //
-// That means a cache size of 1024MB will contain about ~60M entries.
-
-// no. of total hash table entries
-extern uint64_t hash_total_entries;
-
-// no. of hash entries used
-extern uint64_t hash_used;
+// That means a cache size of 1024MB will contain about ~100M entries.
 
 // Constant returned when no hash entry is found in TT
 #define no_hash_found 100000
@@ -57,33 +55,55 @@ extern uint64_t hash_used;
 #define hash_type_alpha 1
 #define hash_type_beta  2
 
+// no. of entries per bucket
+#define TTBucketSize 6
 
 
-// TTEntry struct is the 8 bytes transposition table entry, defined as below:
+
+// TTEntry struct is the 10 bytes transposition table entry, defined as below:
 //
-// key        64 bits
-// depth      32 bits
-// type       32 bits
-// value      32 bits
-// best_move  32 bits
+// key16      16 bits   lower 16 bits of the hash key, XOR'd with the data
+// move16     16 bits   best move, packed (source, target and promoted piece)
+// value16    16 bits   score (mate scores are compressed, see tt.cpp)
+// eval16     16 bits   static evaluation (raw NNUE score, see evaluateNNUE())
+// depth8      8 bits   search depth (0 means the entry is empty)
+// genBound8   8 bits   search generation (6 bits) and hash flag (2 bits)
 //
-// Total size (per entry): 192 bits / 24 bytes
+// Total size (per entry): 80 bits / 10 bytes
 typedef struct {
-    uint64_t key;   
-    int      depth;      
-    int      type;       
-    int      value;
-    int      best_move;
+    uint16_t key16;
+    uint16_t move16;
+    int16_t  value16;
+    int16_t  eval16;
+    uint8_t  depth8;
+    uint8_t  genBound8;
 } TTEntry_t;
 
+
+
+// TTBucket struct is a cache line with TTBucketSize entries, padded to 64
+// bytes.
+typedef struct {
+    TTEntry_t entry[TTBucketSize];
+    char      padding[64 - TTBucketSize * sizeof(TTEntry_t)];
+} TTBucket_t;
+
+static_assert(sizeof(TTBucket_t) == 64, "TT buckets must fill a cache line");
+
+
+
 // Global Transposition Table data structure:
-extern TTEntry_t *hash_table;
+extern TTBucket_t *hash_table;
+
+// no. of total hash table buckets
+extern uint64_t hash_total_buckets;
 
 
 
 // Zobrist hash key functionality:
 void initRandomKeys();
-uint64_t generateHashkey();
+uint64_t generateHashkey(Position_t &);
+uint64_t polyglotKey(Position_t &);
 
 
 
@@ -93,23 +113,37 @@ namespace TT
 {
 
 void clear();
+void clearWritten();
+void trackWrites(bool);
 void init(uint32_t);
-int probe(int, int, int &, int);
-void save(int, int, int, int);
+void newSearch();
+int probe(Position_t &, int, int, int &, int, int &);
+void save(Position_t &, int, int, int, int, int);
+int hashfull();
 
 
 
-// TT::hashfull
+// TT::bucket
 //
-// Returns an approximation of the hashtable occupation during a search. The
-// hash is x permill full, as per UCI protocol.
-static inline int hashfull()
+// Return the bucket where the position with the given hash key is stored.
+// Instead of a modulo, the index is the high half of the 128-bit product of
+// the key and the number of buckets, which maps the keys uniformly as well.
+static inline TTBucket_t *bucket(uint64_t key)
 {
-    // reliability checks
-    assert(hash_total_entries > 0);
+    __extension__ typedef unsigned __int128 uint128_t;
+
+    return &hash_table[((uint128_t) key * hash_total_buckets) >> 64];
+}
+
 
 
-    return (hash_used * 1000) / hash_total_entries;
+// TT::prefetch
+//
+// Bring the bucket of the given hash key into the cache, so that a later
+// probe of the position doesn't have to wait for memory.
+static inline void prefetch(uint64_t key)
+{
+    __builtin_prefetch(bucket(key));
 }
 
 
@@ -21,16 +21,29 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <cstring>
 #include <chrono>
-#include <future>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <atomic>
 
 #include "bitboard.h"
 #include "movgen.h"
 #include "position.h"
 #include "search.h"
+#include "movepick.h"
 #include "uci.h"
 #include "eval.h"
 #include "tt.h"
+#include "thread.h"
+#include "tb.h"
+#include "book.h"
+#include "stats.h"
+#include "timeman.h"
 
 
 
@@ -43,6 +56,135 @@ using namespace std;
 
 
 
+// Position set up by the GUI (the root position of the search)
+static Position_t pos;
+
+
+
+// Positions searched by the "bench" command: changing this list changes the
+// bench signature (i.e., the total number of nodes searched)
+static const char *BenchPositions[] =
+{
+    // perft test positions (see position.h)
+    FenPosStartpos,
+    FenPosKiwipete,
+    FenPos3,
+    FenPos4,
+    FenPos5,
+    FenPos6,
+
+    // Elometer and other test suites (see benchmark.py)
+    "r1bq1rk1/2p1bppp/p1np1n2/4p3/Pp2P3/1BN2N2/1PPP1PPP/R1BQR1K1 w - - 0 1",
+    "8/R7/1p2k3/2p1q1p1/2P1Q3/1P2K1P1/7r/8 w - - 0 1",
+    "5rk1/2b2ppp/pp3n2/2p1p1B1/4P3/2NP4/PPP2PPP/5RK1 w - - 0 1",
+    "8/8/8/1Pk5/8/8/2P3K1/8 w - - 0 1",
+    "r3k2r/5ppp/p3p3/1p1p4/1PpP4/2P1P3/P3KPPP/RR6 w kq - 0 1",
+    "k7/8/3r4/8/4N3/5K2/5P2/8 w - - 0 1",
+    "r2qr2k/6pp/pp1p4/3Pn1N1/8/1P4P1/P2Q3P/R3R1K1 w - - 0 1",
+    "8/2P5/3K4/5b2/1p6/6k1/8/8 w - - 0 1",
+    "R7/5qpk/1p6/2p1rb1p/2Q5/2P3P1/1P3P1P/7K w - - 0 1",
+    "2r3k1/1ppq1pp1/p1n2n1p/8/3P4/1PBQ1N1P/P4PP1/3R2K1 w - - 0 1",
+    "r2qk2r/ppp2ppp/1n1p1nb1/8/2PP4/2NB2P1/PP3PP1/R1BQ1RK1 w kq - 0 1",
+    "2b5/ppp1k1pp/2n1p3/1BNp1p2/3P3P/PP2P1P1/1P1K1P2/8 w - - 0 1",
+    "r2q1rk1/1ppn1ppp/p2np3/3p4/B2P4/2P1PN2/P1P1QPPP/R4RK1 w - - 0 1",
+    "r4rk1/2qnppb1/4p1p1/4P1N1/1p1P1P2/1P6/1KP1N3/3R2QR w - - 0 1",
+    "4br2/p1q1p1k1/4Q1p1/1pN2n2/1P1b4/8/P3B1PP/4BR1K w - - 0 1",
+    "8/p7/Pp1kB3/1Ppn2K1/2P5/8/8/8 w - - 0 1",
+    "rr3nk1/6q1/2p1pRP1/3pP1Qp/6p1/2P3P1/N6P/K1R5 w - - 0 1",
+    "6r1/pkpq3p/6p1/2P5/2NPnP2/1P5R/7K/3Q4 w - - 0 1",
+    "r1bqk2r/pp1n1ppp/2p2n2/3p4/P2Pp3/2P1P3/2PN1PPP/R1BQKB1R w KQkq - 0 1",
+    "7R/8/8/8/3kp3/8/r7/4K3 w - - 0 1",
+    "r4r1k/1p1bbppp/1qp1pn2/4B3/3P3P/1P1B1QR1/P3NPP1/1K1R4 w - - 0 1",
+    "r2qr1k1/1bpn1p1p/1p3bp1/p3p3/P1P5/4PN1P/1PQ1BPPB/R2R2K1 w - - 0 1",
+    "5rk1/R6p/3pp3/2p1n2r/2q5/2B5/1PQ2PPP/5RK1 w - - 0 1",
+    "5q2/1p2k3/p2p4/5bp1/1B6/P2P1P2/2K3P1/1Q6 w - - 0 1",
+    "r4r2/2k2qpp/pRbbR3/P2p1P2/P1pP2P1/2B2Q2/2B5/6K1 w - - 0 1",
+    "r2k3r/pp3pb1/3p3p/1BpP2p1/Q7/P1P2q2/1P3P2/R3R1K1 w - - 0 1",
+    "rn2k2r/1bQ1qpp1/p3p3/2bp4/P2N3p/2PB4/1P3PPP/R1B1R1K1 w kq - 0 1",
+    "3k1r2/4R3/2pB4/pqP2b1p/3P4/2Pp2P1/8/2K1Q3 w - - 0 1",
+    "rr4k1/R1Q2ppp/4pq2/8/7n/3P4/2P2NPP/5R1K w - - 0 1",
+    "r3r1k1/4b1pp/3p3P/6P1/2p1b1q1/4B3/PP1Q2B1/K5RR w - - 0 1",
+    "4r2k/5Qpp/8/2N5/3n2p1/8/2P3PP/4qR1K w - - 0 1",
+    "r2qrnk1/pp2bppp/2p1bn2/3p2B1/3P4/2NBPN2/PPQ2PPP/1R3RK1 w - - 0 1",
+    "r3kb1r/pp4p1/2p1p1p1/4p3/8/2PqPQ1P/PP1N2P1/1R2K2R w Kkq - 0 1",
+    "3kN2b/2p4P/2p2p2/2P2P1K/8/8/8/8 w - - 0 1",
+    "rn2k2r/p4pp1/1p2p2p/1P1pPn1P/2qP4/5N2/2PB1PP1/RQ2K2R w KQkq - 0 1",
+    "6k1/p1P5/P1r5/2p1K3/8/8/2R5/8 w - - 0 1",
+    "r2q1rk1/pbp1bppp/1p2pn2/6B1/3P4/3B1N2/PPP1QPPP/R4RK1 w - - 0 1",
+    "rr4k1/1q3ppp/1bQRp3/6P1/4P3/P4N2/1P6/K3R3 w - - 0 1",
+    "4k2r/1p3ppp/p1n5/2r1p3/4P3/2N5/PP2KPPP/2RR4 w k - 0 1",
+    "8/8/5p2/5p2/5P2/3p3B/5k1P/3K4 w - - 0 1",
+    "r4rk1/pb1qn1pp/1pnNp3/3pPp2/PP1P1P2/5N2/3Q2PP/R3KB1R w KQ - 0 1",
+    "r4r2/6kp/2pqppp1/pbR5/3P4/4QN2/PP3PPP/2R3K1 w - - 0 1",
+    "2r5/pp2kp2/3q1p1Q/3Pp3/6b1/1B6/P1P3PP/1K3R2 w - - 0 1",
+    "r6k/1p4pp/p2q4/1r3P2/2npQ2P/6P1/R1PB1P2/2K1R3 w - - 0 1",
+    "2k4r/p1b2p2/Pp1r1q1p/1Pp1p3/4P1pP/2P1R1P1/5PB1/1RQ3K1 w - - 0 1",
+    "r3k1nr/pp1nq1p1/1bp1b2p/3pPp2/3P1B2/2PB1N2/PP1NQ1PP/R3K2R w KQkq - 0 1",
+    "r1bq1rk1/ppp2pp1/2np1n1p/3Np1NQ/7P/1B1P4/PPP2PP1/2KR3R w - - 0 1",
+    "4r1k1/1b4pp/p1p1r3/2Pp1qb1/PP2p3/2N3B1/4RPPP/3RQ1K1 w - - 0 1",
+    "r4r2/pppqbpk1/2n1b2p/4p1p1/3pP3/3P2PP/PPPN1PBK/R2Q1RN1 w - - 0 1",
+
+    // https://www.chessprogramming.org/Silent_but_Deadly
+    "1r2r1k1/3bnppp/p2q4/2RPp3/4P3/6P1/2Q1NPBP/2R3K1 w - - 0 1",
+    "6k1/pp2rp1p/2p2bp1/1n1n4/1PN3P1/P2rP2P/R3NPK1/2B2R2 w - - 0 1",
+    "8/2p2kpp/p6r/4Pp2/1P2pPb1/2P3P1/P2B1K1P/4R3 w - - 0 1",
+    "Q5k1/5pp1/5n1p/2b2P2/8/5N1P/5PP1/2q1B1K1 b - - 0 1",
+    "r1b1qrk1/pp4b1/2pRn1pp/5p2/2n2B2/2N2NPP/PPQ1PPB1/5RK1 w - - 0 1",
+    "r1b2rk1/2qnbp1p/p1npp1p1/1p4PQ/4PP2/1NNBB3/PPP4P/R4RK1 w - - 0 1",
+    "r1bq1rk1/ppp2ppp/2n1pn2/3p4/1bPP4/2NBPN2/PP3PPP/R1BQK2R w KQ - 0 1",
+    "r1bqk2r/bp3ppp/p1n1pn2/3p4/1PP5/P1N1PN2/1B3PPP/R2QKB1R b KQkq - 0 1",
+    "r1bqk2r/p2pppbp/2p3pn/2p5/4P3/2P2N2/PP1P1PPP/RNBQR1K1 b kq - 0 1",
+    "r1bqk2r/pp2ppbp/2np1np1/2p5/4P3/1B1P1N1P/PPP2PP1/RNBQK2R w KQkq - 0 1",
+    "r1rn2k1/pp1qppbp/6p1/3pP3/3P4/1P3N1P/PB1Q1PP1/R3R1K1 w - - 0 1",
+    "r2q1rk1/1b1nbpp1/pp2pn1p/8/2BN3B/2N1P3/PP2QPPP/2R2RK1 w - - 0 1",
+    "r2q1rk1/pb2bppp/npp1pn2/3pN3/2PP4/1PB3P1/P2NPPBP/R2Q1RK1 w - - 0 1",
+    "r2q1rk1/pppb1pbp/2np1np1/4p3/2P5/P1NPPNP1/1P3PBP/R1BQK2R w KQ - 0 1",
+    "r2qkb1r/pb1n1p2/2p1p2p/4P1pn/PppP4/2N2NB1/1P2BPPP/R2Q1RK1 w kq - 0 1",
+    "r4r1k/pp1bq1b1/n2p2p1/2pPp1Np/2P4P/P1N1BP2/1P1Q2P1/2KR3R w - - 0 1",
+    "r4rk1/1q2bppp/p1bppn2/8/3BPP2/3B2Q1/1PP1N1PP/4RR1K w - - 0 1",
+    "r4rk1/pp2qpp1/2pRb2p/4P3/2p5/2Q1PN2/PP3PPP/4K2R w K - 0 1",
+    "r7/3rq1kp/2p1bpp1/p1Pnp3/2B4P/PP4P1/1B1RQP2/2R3K1 b - - 0 1",
+    "rn1q1rk1/p4pbp/bp1p1np1/2pP4/8/P1N2NP1/1PQ1PPBP/R1B1K2R w KQ - 0 1",
+    "rnbqr1k1/pp1p1ppp/5n2/3Pb3/1P6/P1N3P1/4NPBP/R1BQK2R w KQ - 0 1",
+
+    // https://www.chessprogramming.org/CCR_One_Hour_Test
+    "rn1qkb1r/pp2pppp/5n2/3p1b2/3P4/2N1P3/PP3PPP/R1BQKBNR w KQkq - 0 1",
+    "r1bqk2r/ppp2ppp/2n5/4P3/2Bp2n1/5N1P/PP1N1PP1/R2Q1RK1 b kq - 1 10",
+    "rnbq1rk1/pppp1ppp/4pn2/8/1bPP4/P1N5/1PQ1PPPP/R1B1KBNR b KQ - 1 5",
+    "r4rk1/3nppbp/bq1p1np1/2pP4/8/2N2NPP/PP2PPB1/R1BQR1K1 b - - 1 12",
+    "r1bq1rk1/1pp2pbp/p1np1np1/3Pp3/2P1P3/2N1BP2/PP4PP/R1NQKB1R b KQ - 1 9",
+    "rnbqkb1r/pppp1ppp/5n2/4p3/4PP2/2N5/PPPP2PP/R1BQKBNR b KQkq f3 1 3",
+    "r2q1rk1/2p1bppp/p2p1n2/1p2P3/4P1b1/1nP1BN2/PP3PPP/RN1QR1K1 w - - 1 12",
+    "r1bqkb1r/2pp1ppp/p1n5/1p2p3/3Pn3/1B3N2/PPP2PPP/RNBQ1RK1 b kq - 2 7",
+    "r3kb1r/pp1n1ppp/1q2p3/n2p4/3P1Bb1/2PB1N2/PPQ2PPP/RN2K2R w KQkq - 3 11",
+    "r2qkbnr/ppp1pp1p/3p2p1/3Pn3/4P1b1/2N2N2/PPP2PPP/R1BQKB1R w KQkq - 2 6",
+
+    // https://www.chessprogramming.org/Eigenmann_Rapid_Engine_Test
+    "r1bqk1r1/1p1p1n2/p1n2pN1/2p1b2Q/2P1Pp2/1PN5/PB4PP/R4RK1 w q - 0 1",
+    "5rk1/pp1b4/4pqp1/2Ppb2p/1P2p3/4Q2P/P3BPP1/1R3R1K b - - 0 1",
+    "1nrq1rk1/p4pp1/bp2pn1p/3p4/2PP1B2/P1PB2N1/4QPPP/1R2R1K1 w - - 0 1",
+    "r3r2k/1bq1nppp/p2b4/1pn1p2P/2p1P1QN/2P1N1P1/PPBB1P1R/2KR4 w - - 0 1",
+    "rqn2rk1/pp2b2p/2n2pp1/1N2p3/5P1N/1PP1B3/4Q1PP/R4RK1 w - - 0 1",
+    "r3k2r/5ppp/3pbb2/qp1Np3/2BnP3/N7/PP1Q1PPP/R3K2R w KQkq - 0 1",
+    "rnb2rk1/pp2q2p/3p4/2pP2p1/2P1Pp2/2N5/PP1QBRPP/R5K1 w - - 0 1",
+    "r1b2rk1/p2nqppp/1ppbpn2/3p4/2P5/1PN1PN2/PBQPBPPP/R4RK1 w - - 0 1",
+    "r1bq1rk1/p4ppp/3p2n1/1PpPp2n/4P2P/P1PB1PP1/2Q1N3/R1B1K2R b KQ - 0 1",
+    "r4rk1/ppp2ppp/1nnb4/8/1P1P3q/PBN1B2P/4bPP1/R2QR1K1 w - - 0 1",
+
+    // https://www.chessprogramming.org/Kaufman_Test
+    "1rbq1rk1/p1b1nppp/1p2p3/8/1B1pN3/P2B4/1P3PPP/2RQ1R1K w - - 0 1",
+    "r1b1r1k1/1ppn1p1p/3pnqp1/8/p1P1P3/5P2/PbNQNBPP/1R2RB1K w - - 0 1",
+    "2r2rk1/1bqnbpp1/1p1ppn1p/pP6/N1P1P3/P2B1N1P/1B2QPP1/R2R2K1 b - - 0 1",
+    "3r2k1/ppq2pp1/4p2p/3n3P/3N2P1/2P5/PP2QP2/K2R4 b - - 0 1",
+    "1r2r1k1/p4p1p/6pB/q7/8/3Q2P1/PbP2PKP/1R3R2 w - - 0 1",
+    "r2q1r1k/pb3p1p/2n1p2Q/5p2/8/3B2N1/PP3PPP/R3R1K1 w - - 0 1",
+    "1r1q1rk1/p1p2pbp/2pp1np1/6B1/4P3/2NQ4/PPP2PPP/3R1RK1 w - - 0 1",
+    "rn1q1rk1/1b2bppp/1pn1p3/p2pP3/3P4/P2BBN1P/1P1N1PP1/R2Q1RK1 b - - 0 1",
+    "8/p1ppk1p1/2n2p2/8/4B3/2P1KPP1/1P5P/8 w - - 0 1"
+};
+
+
+
 // UCI::moveToString converts a Move to a string in coordinate notation
 // (e.g., g1f3, a7a8q).
 //
@@ -74,12 +216,8 @@ string UCI::moveToString(int m)
 // UCI::parseMove
 //
 // UCI::to_move() converts a string representing a move in coordinate notation
-// (g1f3, a7a8q) to the corresponding (pseudo) legal move, if any.
-//
-// Note: the move will be considered legal if it is in the pseudo-legal moves
-//       list. That means you must take care of checking legality after parsing
-//       the move, before making it on the board; i.e, is King in check?
-int UCI::parseMove(string str)
+// (g1f3, a7a8q) to the corresponding legal move, if any.
+int UCI::parseMove(Position_t &pos, string str)
 {
     // verify promotion and make sure it is in lower-case
     if (str.length() == 5)
@@ -88,10 +226,10 @@ int UCI::parseMove(string str)
 
     // generate all moves
     MoveList_t MoveList;
-    generateMoves(MoveList);
+    generateMoves(pos, MoveList);
 
 
-    // try to find the move in the list of pseudo-legal moves
+    // try to find the move in the list of legal moves
     for (int move_count = 0; move_count < MoveList.count; move_count++)
     {
         if (str == moveToString(MoveList.moves[move_count]))
@@ -147,28 +285,31 @@ void UCI::position(istringstream &is)
 
 
     // set up the position
-    setPosition(fen);
+    setPosition(pos, fen);
 
 
     // parse move list, if any
-    while ((is >> token) && ((m = UCI::parseMove(token)) != 0))
+    while ((is >> token) && ((m = UCI::parseMove(pos, token)) != 0))
     {
-        saveBoard();
+        // make the move on the board (parseMove() only returns legal moves)
+        makeMove(pos, m);
 
-        // increment repetition index
-        repetition_index++;
-            
-        // wtire hash key into a repetition table
-        repetition_table[repetition_index] = hash_key;
 
-        // test whether the move is legal and make it on the board
-        if (!makeMove(m))
-        {
-            // undo move, if not legal
-            takeBack();
+        // the positions before an irreversible move (capture or pawn move,
+        // both reset the fifty counter) can't be repeated anymore (see
+        // isRepetition()), so they are dropped from the undo stack, which
+        // makes room for games of any length: with fewer than 100 plies
+        // between irreversible moves, the fallback below is never used
+        if (pos.fifty == 0)
+            pos.gamePly = 0;
 
-            // decrement repetition index
-            repetition_index--;
+
+        // the game is a draw by the fifty move rule anyway, but keep enough
+        // room for the search: only the last 100 plies can be repeated
+        else if (pos.gamePly >= MaxGamePly - MaxPly - 1)
+        {
+            memmove(pos.states, pos.states + pos.gamePly - 100, 100 * sizeof(StateInfo_t));
+            pos.gamePly = 100;
         }
     }
 }
@@ -195,52 +336,24 @@ void UCI::go(istringstream &is)
     while (is >> token)
     {
         // "wtime": time remaning on the clock for White
-        if (token == "wtime")     
-        {
+        if (token == "wtime")
             is >> Limits.wtime;
 
-            if (Limits.wtime > 0)
-            {
-                if (sideToMove == White)
-                    Limits.movetime = Limits.wtime;
-            }
-        }
 
-        
         // "btime": time remaning on the clock for Black
         else if (token == "btime")
-        {
             is >> Limits.btime;
 
-            if (Limits.btime > 0)
-            {
-                if (sideToMove == Black)
-                    Limits.movetime = Limits.btime;
-            }
-        }
-
 
         // "winc": time increment for White
         else if (token == "winc")
-        {
             is >> Limits.winc;
 
-            if (Limits.winc > 0)
-                if (sideToMove == White)
-                    inc = Limits.winc;
-        }
-
 
         // "binc": time increment for Black
         else if (token == "binc")
-        {
             is >> Limits.binc;
 
-            if (Limits.binc > 0)
-                if (sideToMove == Black)
-                    inc = Limits.binc;
-        }
-
 
         // "movestogo": number of moves left for the next time control
         else if (token == "movestogo")
@@ -276,9 +389,6 @@ void UCI::go(istringstream &is)
         {
             is >> Limits.movetime;
 
-            timeset = true;
-            Limits.movestogo = 1;
-
             if (Limits.movetime <= 0)
                 Limits.movetime = 1;
         }
@@ -306,38 +416,722 @@ void UCI::go(istringstream &is)
         else if (token == "perft")
         {
             is >> Limits.perft;
-            dperft(Limits.perft);
+            dperft(pos, Limits.perft);
             return;
         }
     }
 
 
-    // configure internal timing, if time control is available
-    if ((Limits.movetime > 0) && !Limits.infinite)
+    // play a book move right away, without searching, unless analyzing
+    if (Options["OwnBook"] && !Limits.infinite && !Limits.ponder && !Limits.mate)
     {
-        // set up timing
-        timeset = true;
-        Limits.movetime /= Limits.movestogo;
-
-        // compensate for lag
-        if (Limits.movetime > 500)
-            Limits.movetime -= 50;
-        
-        // init max. stop time
-        stoptime = starttime + Limits.movetime + inc;
-
-        // treat increment as seconds per move when time is almost up
-        if ((Limits.movetime < 500) && inc && (Limits.depth == MaxSearchDepth))
-            stoptime = starttime + inc - 50;
+        int move = Book::probe(pos);
+
+        if (move)
+        {
+            Threads::send("bestmove " + prettyMove(move) + "\n");
+            return;
+        }
     }
 
 
-    // constaintly watch the clock and other limits that will stop the search
-    auto io = async(launch::async, watchClockAndInput);
+    // configure internal timing, if time control is available: when
+    // pondering, the time limits only apply after "ponderhit"
+    Time::init(pos.sideToMove);
+    pondering       = Limits.ponder;
+    stopOnPonderhit = false;
+
+
+    // start the search in the background: the clock and the other limits
+    // are checked by the search itself, while the UCI loop keeps reading
+    // the input (e.g., "stop")
+    Threads::startSearch(pos);
+}
+
+
 
+// Set when a command (e.g., "bench") has resized the hash table: the size of
+// the Hash option is only restored by the next command that needs it (see
+// restoreHash()), so that "gargantua bench" doesn't allocate it for nothing.
+static bool hashResized = false;
 
-    // start the search
-    search();
+
+
+// restoreHash
+//
+// Resize the hash table back to the Hash option, if it was resized.
+static void restoreHash()
+{
+    if (hashResized)
+    {
+        TT::init(Options["Hash"]);
+        hashResized = false;
+    }
+}
+
+
+
+// UCI::bench
+//
+// Search all the positions in BenchPositions[] to a fixed depth, with the
+// given Hash size (MBytes) and number of Threads, and print the total number
+// of nodes searched, the time taken and the speed (nps):
+//
+//     bench [depth] [hash] [threads]
+//
+// With a single thread the search is deterministic, so the total number of
+// nodes is a signature of the search: it only changes if the search does.
+// The Threads option is restored afterwards, the Hash option when needed.
+void UCI::bench(istringstream &is)
+{
+    // parse the bench settings, if any
+    int depth = BenchDefaultDepth, hash = BenchDefaultHash, threads = BenchDefaultThreads;
+
+    if (!(is >> depth) || (depth <= 0))
+        depth = BenchDefaultDepth;
+
+    if (!(is >> hash))
+        hash = BenchDefaultHash;
+
+    if (!(is >> threads))
+        threads = BenchDefaultThreads;
+
+    hash    = std::clamp(hash, HashMinSize, HashMaxSize);
+    threads = std::clamp(threads, ThreadsMin, ThreadsMax);
+
+
+    // set up the hash table and the search threads for the bench
+    TT::init(hash);
+    Threads::init(threads);
+    hashResized = true;
+
+
+    // search every position from scratch (empty hash table and eval caches)
+    int count = sizeof(BenchPositions) / sizeof(BenchPositions[0]);
+    uint64_t total = 0ULL;
+    auto start = chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < count; i++)
+    {
+        cout << endl << "Position: " << (i + 1) << "/" << count << " (" << BenchPositions[i] << ")" << endl;
+
+        setPosition(pos, BenchPositions[i]);
+        TT::clear();
+        clearEvalCache();
+        initSearch();
+        resetTimeControl();
+        Limits.depth = depth;
+        Time::init(pos.sideToMove);
+
+        search(pos);
+        Threads::flushOutput();
+        total += Threads::nodes();
+    }
+
+    auto finish = chrono::high_resolution_clock::now();
+    auto ms = chrono::duration_cast<chrono::milliseconds>(finish - start).count();
+
+
+    // restore the search threads and the starting position (the hash table
+    // is restored by the next command that needs it)
+    Threads::init(Options["Threads"]);
+    setPosition(pos, FenPosStartpos);
+
+
+    // print the summary
+    cout << endl << "==========================="
+         << endl << "Total time (ms) : " << ms
+         << endl << "Nodes searched  : " << total
+         << endl << "Nodes/second    : " << total * 1000 / (ms + 1)
+         << endl << endl << flush;
+}
+
+
+
+// UCI::analyze
+//
+// Batch analysis: search every position (one FEN per line) of a file, or of
+// the standard input when the file is "-", to a fixed depth, and write one
+// line per position with the FEN, the score (centipawns, or "#N" for a mate
+// in N), the best move and the nodes searched, separated by commas:
+//
+//     analyze <file|-> [depth N] [hash H] [threads T] [output <file>] [warm]
+//
+// The positions are streamed to T worker threads, each with its own board,
+// and the results are written as soon as they are ready (so not necessarily
+// in the order of the input) to the standard output, or to the file given.
+// Every position is searched from scratch, unless "warm" is given to keep
+// the TT between positions (e.g., for positions from the same games); with
+// more than one thread, the TT is always shared by all the positions. Only
+// the buckets written by the previous position are cleared, so the cost
+// doesn't depend on the hash size.
+void UCI::analyze(istringstream &is)
+{
+    string input, output, token;
+    int depth   = AnalyzeDefaultDepth;
+    int hash    = AnalyzeDefaultHash;
+    int threads = AnalyzeDefaultThreads;
+    bool warm   = false;
+
+
+    // parse the arguments
+    is >> input;
+
+    while (is >> token)
+    {
+        if (token == "depth")
+            is >> depth;
+        else if (token == "hash")
+            is >> hash;
+        else if (token == "threads")
+            is >> threads;
+        else if (token == "output")
+            is >> output;
+        else if (token == "warm")
+            warm = true;
+    }
+
+    if (input.empty())
+    {
+        cout << "Usage: analyze <file|-> [depth N] [hash H] [threads T] [output <file>] [warm]" << endl << flush;
+        return;
+    }
+
+    depth   = std::clamp(depth,   1, MaxSearchDepth);
+    hash    = std::clamp(hash,    HashMinSize, HashMaxSize);
+    threads = std::clamp(threads, ThreadsMin, ThreadsMax);
+
+
+    // open the input and output streams
+    ifstream fin;
+    ofstream fout;
+    istream *in  = &cin;
+    ostream *out = &cout;
+
+    if (input != "-")
+    {
+        fin.open(input);
+        if (!fin)
+        {
+            cout << "info string Cannot open " << input << endl << flush;
+            return;
+        }
+
+        in = &fin;
+    }
+
+    if (!output.empty())
+    {
+        fout.open(output);
+        if (!fout)
+        {
+            cout << "info string Cannot create " << output << endl << flush;
+            return;
+        }
+
+        out = &fout;
+    }
+
+
+    // set up the hash table and a search without other limits than depth
+    TT::init(hash);
+    initSearch();
+    resetTimeControl();
+    TB::clearRootMoves();
+
+
+    // the workers take the next FEN from the input, search it on their own
+    // board (Position_t is too large for the stack), and write the result
+    mutex inputMtx, outputMtx;
+    uint64_t count = 0ULL, total = 0ULL;
+    bool cold = !warm && (threads == 1);
+    auto start = chrono::high_resolution_clock::now();
+
+    TT::trackWrites(cold);
+
+    auto worker = [&]()
+    {
+        unique_ptr<Position_t> board(new Position_t);
+        string fen, line;
+        int move, score;
+
+
+        while (true)
+        {
+            // read the next position, skipping blank lines and comments
+            {
+                lock_guard<mutex> lock(inputMtx);
+
+                while (getline(*in, fen))
+                    if ((fen.find_first_not_of(" \t\r") != string::npos) && (fen[0] != '#'))
+                        break;
+
+                if (!*in)
+                    return;
+            }
+
+
+            // search the position from scratch, unless the TT is kept warm:
+            // only the buckets written by the previous position are cleared
+            if (cold)
+            {
+                TT::clearWritten();
+                TT::newSearch();
+            }
+
+            setPosition(*board, fen);
+            score = analyzePosition(*board, depth, move);
+
+
+            // format the result
+            line = fen + ",";
+
+            if (score > MateScore)
+                line += "#" + to_string((MateValue - score) / 2 + 1);
+            else if (score < -MateScore)
+                line += "#" + to_string(-(score + MateValue) / 2 - 1);
+            else
+                line += to_string(score);
+
+            line += "," + prettyMove(move) + "," + to_string(nodes.load(memory_order_relaxed)) + "\n";
+
+
+            // write it, without flushing the output after every line
+            lock_guard<mutex> lock(outputMtx);
+            *out << line;
+            count++;
+            total += nodes.load(memory_order_relaxed);
+        }
+    };
+
+
+    // analyze all the positions in parallel
+    vector<thread> workers;
+
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(worker);
+
+    for (thread &t : workers)
+        t.join();
+
+    TT::trackWrites(false);
+    out->flush();
+
+    auto finish = chrono::high_resolution_clock::now();
+    auto ms = chrono::duration_cast<chrono::milliseconds>(finish - start).count();
+
+
+    // print the summary apart from the results, which may go to stdout
+    cerr << "Positions       : " << count
+         << endl << "Total time (ms) : " << ms
+         << endl << "Nodes searched  : " << total
+         << endl << "Nodes/second    : " << total * 1000 / (ms + 1)
+         << endl << flush;
+
+
+    // the hash table is restored by the next command that needs it
+    hashResized = true;
+}
+
+
+
+// Huffman codes of the pieces (Pawn to Queen) in the packed positions of the
+// Stockfish training data; an empty square is a single 0 bit
+static constexpr int SfenPieceCode[5] = { 0b0001, 0b0011, 0b0101, 0b0111, 0b1001 };
+
+static_assert(sizeof(PackedSfenValue_t) == 40, "PackedSfenValue_t must be 40 bytes");
+
+
+
+// packBits
+//
+// Append the lowest 'bits' bits of a value to a bit stream, starting from
+// the least significant bit.
+static void packBits(uint8_t *data, int &cursor, int value, int bits)
+{
+    for (int i = 0; i < bits; i++, cursor++)
+        if (value & (1 << i))
+            data[cursor / 8] |= 1 << (cursor & 7);
+}
+
+
+
+// packPosition
+//
+// Pack a position in the 256 bits of a Stockfish PackedSfen: side to move,
+// both King squares, the rest of the board from a8 to h1, castling rights,
+// enpassant square, 50-move counter and move number. Stockfish numbers the
+// squares from a1, hence the vertical flip (sq ^ 56) of every square.
+static void packPosition(Position_t &pos, uint8_t *data)
+{
+    int cursor = 0;
+    memset(data, 0, 32);
+
+
+    // side to move and Kings
+    packBits(data, cursor, pos.sideToMove == Black, 1);
+    packBits(data, cursor, ls1b(pos.bitboards[K]) ^ 56, 6);
+    packBits(data, cursor, ls1b(pos.bitboards[k]) ^ 56, 6);
+
+
+    // the other pieces, followed by their color
+    for (int sq = a8; sq <= h1; sq++)
+    {
+        int piece = pos.board[sq];
+
+        if ((piece == K) || (piece == k))
+            continue;
+
+        if (piece == NoPiece)
+            packBits(data, cursor, 0, 1);
+        else
+        {
+            packBits(data, cursor, SfenPieceCode[piece % 6], 4);
+            packBits(data, cursor, piece >= p, 1);
+        }
+    }
+
+
+    // castling rights and enpassant square, only if a Pawn can capture there
+    // (as in the Polyglot keys): readers computing the keys expect so
+    packBits(data, cursor, (pos.castle & wk) != 0, 1);
+    packBits(data, cursor, (pos.castle & wq) != 0, 1);
+    packBits(data, cursor, (pos.castle & bk) != 0, 1);
+    packBits(data, cursor, (pos.castle & bq) != 0, 1);
+
+    if ((pos.epsq != NoSq)
+        && (PawnAttacks[pos.sideToMove ^ 1][pos.epsq] & pos.bitboards[(pos.sideToMove == White) ? P : p]))
+    {
+        packBits(data, cursor, 1, 1);
+        packBits(data, cursor, pos.epsq ^ 56, 6);
+    }
+    else
+        packBits(data, cursor, 0, 1);
+
+
+    // 50-move counter and move number, with their high bits at the end
+    int fullmove = 1 + (pos.gamePly - (pos.sideToMove == Black)) / 2;
+
+    packBits(data, cursor, pos.fifty, 6);
+    packBits(data, cursor, fullmove, 8);
+    packBits(data, cursor, fullmove >> 8, 8);
+    packBits(data, cursor, pos.fifty >> 6, 1);
+
+    assert(cursor <= 256);
+}
+
+
+
+// packMove
+//
+// Convert a move to the 16-bit encoding of Stockfish: target square, source
+// square, promoted piece (Knight to Queen) and move type, where castling is
+// encoded as the King capturing its own Rook.
+static uint16_t packMove(int move)
+{
+    int fromSq = getMoveSource(move);
+    int toSq   = getMoveTarget(move);
+    int type   = 0;
+
+    if (getPromo(move))
+        type = (1 << 14) | ((getPromo(move) % 6 - N) << 12);
+    else if (getEp(move))
+        type = 2 << 14;
+    else if (getCastle(move))
+    {
+        type = 3 << 14;
+        toSq = (toSq > fromSq) ? toSq + 1 : toSq - 2;
+    }
+
+    return type | ((fromSq ^ 56) << 6) | (toSq ^ 56);
+}
+
+
+
+// UCI::gensfen
+//
+// Generate training data for the NNUE from self-play games:
+//
+//     gensfen [games G] [depth N] [hash H] [threads T] [random R]
+//             [evallimit E] [maxply M] [seed S] [format bin|plain] [output <file>]
+//
+// Every game starts with R random moves from the initial position, and then
+// both sides play the best move of a search to depth N, until the game is
+// over (mate, stalemate or draw), one side scores E or more (adjudicated as a
+// win for that side), or the game reaches M plies (adjudicated as a draw).
+// Every position of a game, except those in check, is written along with its
+// score, the move played and the final result of the game, in the .bin format
+// of the Stockfish trainers (PackedSfenValue_t) or in their text .plain format
+// ("fen", "move", "score", "ply", "result" and "e" lines). Both can then be
+// converted to .binpack with the usual tools.
+//
+// The games are spread over T threads sharing the TT. Every thread collects
+// its records in a large buffer and writes them in a single call when the
+// buffer is full, so the file is written in big chunks.
+void UCI::gensfen(istringstream &is)
+{
+    string output, format = "bin", token;
+    int games     = GensfenDefaultGames;
+    int depth     = GensfenDefaultDepth;
+    int hash      = GensfenDefaultHash;
+    int threads   = GensfenDefaultThreads;
+    int random    = GensfenDefaultRandomPlies;
+    int evalLimit = GensfenDefaultEvalLimit;
+    int maxPly    = GensfenDefaultMaxPly;
+    uint64_t seed = chrono::steady_clock::now().time_since_epoch().count();
+
+
+    // parse the arguments
+    while (is >> token)
+    {
+        if (token == "games")
+            is >> games;
+        else if (token == "depth")
+            is >> depth;
+        else if (token == "hash")
+            is >> hash;
+        else if (token == "threads")
+            is >> threads;
+        else if (token == "random")
+            is >> random;
+        else if (token == "evallimit")
+            is >> evalLimit;
+        else if (token == "maxply")
+            is >> maxPly;
+        else if (token == "seed")
+            is >> seed;
+        else if (token == "format")
+            is >> format;
+        else if (token == "output")
+            is >> output;
+    }
+
+    if ((format != "bin") && (format != "plain"))
+    {
+        cout << "Usage: gensfen [games G] [depth N] [hash H] [threads T] [random R] "
+             << "[evallimit E] [maxply M] [seed S] [format bin|plain] [output <file>]" << endl << flush;
+        return;
+    }
+
+    games     = std::max(games, 0);
+    depth     = std::clamp(depth,     1, MaxSearchDepth);
+    hash      = std::clamp(hash,      HashMinSize, HashMaxSize);
+    threads   = std::clamp(threads,   ThreadsMin, ThreadsMax);
+    random    = std::clamp(random,    0, 100);
+    evalLimit = std::clamp(evalLimit, 1, 32000);
+    maxPly    = std::clamp(maxPly,    random + 1, MaxGamePly - MaxPly - 1);
+
+    if (output.empty())
+        output = "gensfen." + format;
+
+    bool plain = (format == "plain");
+
+
+    // open the output file
+    ofstream fout(output, ios::binary);
+    if (!fout)
+    {
+        cout << "info string Cannot create " << output << endl << flush;
+        return;
+    }
+
+
+    // set up the hash table and a search without other limits than depth
+    TT::init(hash);
+    initSearch();
+    resetTimeControl();
+    TB::clearRootMoves();
+
+
+    // every worker plays the next game on its own board (Position_t is too
+    // large for the stack) and keeps its records until the game is over,
+    // when the result is known
+    mutex outputMtx;
+    atomic<int> nextGame(0);
+    atomic<uint64_t> count(0), total(0);
+    auto start = chrono::high_resolution_clock::now();
+
+    auto worker = [&](int id)
+    {
+        unique_ptr<Position_t> board(new Position_t);
+        vector<PackedSfenValue_t> records;
+        vector<string> lines;
+        vector<int> sides;
+        string buffer;
+        MoveList_t moves;
+        int move, score, result;
+
+
+        // private XORSHIFT generator of the thread (the state cannot be 0)
+        uint64_t state = (seed + 1) * 0x9e3779b97f4a7c15ULL + (uint64_t)id + 1;
+
+        auto next = [&]()
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        };
+
+
+        buffer.reserve(GensfenBufferSize + 4096);
+
+        while (nextGame++ < games)
+        {
+            // random opening, played again in the rare case it ends the game
+            bool over;
+
+            do
+            {
+                setPosition(*board, FenPosStartpos);
+                over = false;
+
+                for (int i = 0; (i < random) && !over; i++)
+                {
+                    generateMoves(*board, moves);
+
+                    if (moves.count)
+                        makeMove(*board, moves.moves[next() % moves.count]);
+                    else
+                        over = true;
+                }
+            } while (over);
+
+
+            // play the game, with the result from the White point of view
+            records.clear();
+            lines.clear();
+            sides.clear();
+
+            while (true)
+            {
+                int side = board->sideToMove;
+                bool inCheck = isSquareAttacked(*board, (side == White) ? ls1b(board->bitboards[K]) :
+                                                                          ls1b(board->bitboards[k]),
+                                                                          side ^ 1);
+
+
+                // mate or stalemate
+                generateMoves(*board, moves);
+                if (!moves.count)
+                {
+                    result = !inCheck ? 0 : (side == White) ? -1 : 1;
+                    break;
+                }
+
+
+                // draw, or too long a game (isDraw() expects a node of the
+                // search, above the root)
+                board->ply = 1;
+                bool draw = isDraw(*board);
+                board->ply = 0;
+
+                if (draw || (board->gamePly >= maxPly))
+                {
+                    result = 0;
+                    break;
+                }
+
+
+                // search the position, and adjudicate a decisive score
+                score = analyzePosition(*board, depth, move);
+                total += nodes.load(memory_order_relaxed);
+
+                if (abs(score) >= evalLimit)
+                {
+                    result = ((score > 0) == (side == White)) ? 1 : -1;
+                    break;
+                }
+
+
+                // keep the quiet positions only
+                if (!inCheck)
+                {
+                    if (plain)
+                        lines.push_back("fen " + getFEN(*board) + "\nmove " + prettyMove(move)
+                                      + "\nscore " + to_string(score) + "\nply "
+                                      + to_string(board->gamePly) + "\nresult ");
+                    else
+                    {
+                        PackedSfenValue_t psv;
+
+                        packPosition(*board, psv.sfen);
+                        psv.score   = (int16_t)score;
+                        psv.move    = packMove(move);
+                        psv.gamePly = (uint16_t)board->gamePly;
+                        psv.result  = 0;
+                        psv.padding = 0;
+                        records.push_back(psv);
+                    }
+
+                    sides.push_back(side);
+                }
+
+                makeMove(*board, move);
+            }
+
+
+            // now that the result is known, serialize the records of the
+            // game, with the result from the point of view of the side to move
+            for (size_t i = 0; i < sides.size(); i++)
+            {
+                int sideResult = (sides[i] == White) ? result : -result;
+
+                if (plain)
+                    buffer += lines[i] + to_string(sideResult) + "\ne\n";
+                else
+                {
+                    records[i].result = (int8_t)sideResult;
+                    buffer.append((const char *)&records[i], sizeof(PackedSfenValue_t));
+                }
+            }
+
+            count += sides.size();
+
+
+            // write the buffer in a single call when it is full
+            if (buffer.size() >= GensfenBufferSize)
+            {
+                lock_guard<mutex> lock(outputMtx);
+                fout.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+
+
+        // write the rest of the buffer
+        lock_guard<mutex> lock(outputMtx);
+        fout.write(buffer.data(), buffer.size());
+    };
+
+
+    // play all the games in parallel
+    vector<thread> workers;
+
+    for (int i = 0; i < threads; i++)
+        workers.emplace_back(worker, i);
+
+    for (thread &t : workers)
+        t.join();
+
+    fout.close();
+
+    auto finish = chrono::high_resolution_clock::now();
+    auto ms = chrono::duration_cast<chrono::milliseconds>(finish - start).count();
+
+
+    // print the summary
+    cout << "Games           : " << games
+         << endl << "Positions       : " << count
+         << endl << "Total time (ms) : " << ms
+         << endl << "Nodes searched  : " << total
+         << endl << "Positions/second: " << count * 1000 / (ms + 1)
+         << endl << "Output          : " << output
+         << endl << flush;
+
+
+    // the hash table is restored by the next command that needs it
+    hashResized = true;
 }
 
 
@@ -366,7 +1160,7 @@ void UCI::setOption(istringstream& is)
         value += (value.empty() ? "" : " ") + token;
 
 
-    // option name Hash type spin default 1024 min 16 max 1024
+    // option name Hash type spin default 1024 min 16 max 131072
     if (name == "Hash")
     {
         // obtain the MBytes from the value given in the option
@@ -386,6 +1180,7 @@ void UCI::setOption(istringstream& is)
 
         // set hash table size in MB
         TT::init(mb);
+        hashResized = false;
     }
 
 
@@ -394,6 +1189,96 @@ void UCI::setOption(istringstream& is)
         TT::clear();
 
 
+    // option name Threads type spin default 1 min 1 max 256
+    else if (name == "Threads")
+    {
+        // obtain the number of threads from the value given in the option
+        int threads = stoi(value);
+
+        // check min and max boundaries
+        if (threads < ThreadsMin)
+            threads = ThreadsMin;
+
+        if (threads > ThreadsMax)
+            threads = ThreadsMax;
+
+
+        // register the new setting in Options
+        Options["Threads"] = threads;
+
+
+        // create the helper threads
+        Threads::init(threads);
+    }
+
+
+    // option name PerftHash type spin default 0 min 0 max 4096
+    else if (name == "PerftHash")
+    {
+        // obtain the MBytes from the value given in the option
+        int mb = stoi(value);
+
+        // check min and max size boundaries
+        if (mb < 0)
+            mb = 0;
+
+        if (mb > PerftHashMaxSize)
+            mb = PerftHashMaxSize;
+
+
+        // register the new setting in Options
+        Options["PerftHash"] = mb;
+
+
+        // allocate (or free) the perft hash table
+        initPerftHash(mb);
+    }
+
+
+    // option name SyzygyPath type string default <empty>
+    else if (name == "SyzygyPath")
+    {
+        // (re)load the tablebases from the given path(s), the path is not
+        // kept in Options since all the options are integers
+        TB::init(value);
+    }
+
+
+    // option name OwnBook type check default false
+    else if (name == "OwnBook")
+        Options["OwnBook"] = (value == "true");
+
+
+    // option name BookFile type string default <empty>
+    else if (name == "BookFile")
+    {
+        // map the Polyglot book, the file name is not kept in Options since
+        // all the options are integers
+        Book::init(value);
+    }
+
+
+    // option name EvalFile type string default nn-eba324f53044.nnue
+    else if (name == "EvalFile")
+    {
+        // load the network from the given file (or the embedded network), the
+        // current network is kept if it can't be loaded
+        if (value.empty() || (value == "<empty>"))
+            value = EvalFileDefault;
+
+        if (!nnue_init(value.c_str()))
+            cout << "info string Cannot load the neural network " << value << endl << flush;
+
+
+        // the evaluations cached and stored in the TT come from the old network
+        else
+        {
+            clearEvalCache();
+            TT::clear();
+        }
+    }
+
+
     // option name Contempt type spin 
     else if (name == "Contempt")
     {
@@ -411,6 +1296,21 @@ void UCI::setOption(istringstream& is)
     }
 
 
+    // option name MultiPV type spin default 1 min 1 max 256
+    else if (name == "MultiPV")
+        Options["MultiPV"] = std::clamp(stoi(value), 1, OptionsMultiPVMax);
+
+
+    // option name Ponder type check default false
+    else if (name == "Ponder")
+        Options["Ponder"] = (value == "true");
+
+
+    // option name Move Overhead type spin default 50 min 0 max 5000
+    else if (name == "Move Overhead")
+        Options["Move Overhead"] = std::clamp(stoi(value), 0, OptionsMoveOverheadMax);
+
+
     // unknown option
     else
         cout << "No such option: " << name << endl << flush;
@@ -421,14 +1321,14 @@ void UCI::setOption(istringstream& is)
 // UCI::traceEval
 //
 // Print the evaluation for the current position.
-void UCI::traceEval()
+void UCI::traceEval(Position_t &pos)
 {
     // display current board
-    printBoard();
+    printBoard(pos);
 
     // print evaluaton in user-friendly format; e.g., -1.28
     cout << showpos << fixed << setprecision(2) << "NNUE evaluation: "
-         << evaluate() / 100.0f << endl << endl << flush;
+         << evaluate(pos) / 100.0f << endl << endl << flush;
 
     // reset formating
     cout << resetiosflags(cout.flags());
@@ -454,7 +1354,7 @@ void UCI::loop(int argc, char* argv[])
 
 
     // set the starting position by default
-    setPosition(FenPosStartpos);
+    setPosition(pos, FenPosStartpos);
 
 
     // prepare and take in commands from the command line, if any
@@ -482,27 +1382,69 @@ void UCI::loop(int argc, char* argv[])
         is >> skipws >> token;
 
 
+        // only a few commands are handled while searching: the rest of them
+        // (e.g., "position" or "setoption") wait for the search to finish
+        if ((token != "stop") && (token != "ponderhit") && (token != "isready") && (token != "uci")
+                              && (token != "quit") && (token != "q"))
+            Threads::waitSearch();
+
+
+        // restore the hash table (no search is running after a "bench"),
+        // unless the command sets its own size
+        if (   hashResized && (token != "bench") && (token != "analyze") && (token != "gensfen")
+            && (token != "setoption") && (token != "quit") && (token != "q"))
+            restoreHash();
+
+
         // "quit": stop the search and terminate the program
         if ((token == "quit") || (token == "q"))
+        {
+            stopSearch();
+            Threads::waitSearch();
             return;
+        }
 
 
         // "stop": halt the search but keep the UCI loop open
         else if (token == "stop")
-            timedout = true;
+            stopSearch();
 
 
-        // "uci": print engine information
-        else if (token == "uci")
-        {
-            cout << "id name "   << EngineName << " " << EngineVersion << endl;
-            cout << "id author " << EngineAuthor << endl; 
+        // "ponderhit": the opponent played the expected move, so the search
+        // goes on under the normal time limits
+        else if (token == "ponderhit")
+            ponderhit();
 
-            cout << "option name Hash type spin default 1024 min 16 max 1024" << endl;
-            cout << "option name Clear Hash type button" << endl;
-            cout << "option name Contempt type spin default 25 min 0 max 200" << endl;
 
-            cout << "uciok" << endl << flush;
+        // "uci": print engine information (it can arrive during a search,
+        // so it goes through the output thread, as a single write)
+        else if (token == "uci")
+        {
+            ostringstream ss;
+
+            ss << "id name "   << EngineName << " " << EngineVersion << "\n";
+            ss << "id author " << EngineAuthor << "\n";
+
+            ss << "option name Hash type spin default " << OptionsDefaultHashSize
+               << " min " << HashMinSize << " max " << HashMaxSize << "\n";
+            ss << "option name Clear Hash type button" << "\n";
+            ss << "option name Threads type spin default 1 min 1 max 256" << "\n";
+            ss << "option name Contempt type spin default 25 min 0 max 200" << "\n";
+            ss << "option name PerftHash type spin default " << OptionsDefaultPerftHash
+               << " min 0 max " << PerftHashMaxSize << "\n";
+            ss << "option name SyzygyPath type string default <empty>" << "\n";
+            ss << "option name EvalFile type string default " << EvalFileDefault << "\n";
+            ss << "option name OwnBook type check default false" << "\n";
+            ss << "option name BookFile type string default <empty>" << "\n";
+            ss << "option name Ponder type check default false" << "\n";
+            ss << "option name MultiPV type spin default " << OptionsDefaultMultiPV
+               << " min 1 max " << OptionsMultiPVMax << "\n";
+            ss << "option name Move Overhead type spin default " << OptionsDefaultMoveOverhead
+               << " min 0 max " << OptionsMoveOverheadMax << "\n";
+
+            ss << "uciok" << "\n";
+
+            Threads::send(ss.str());
         }
 
 
@@ -524,25 +1466,25 @@ void UCI::loop(int argc, char* argv[])
         // "ucinewgame" command: start
         else if (token == "ucinewgame")
         {
-            setPosition(FenPosStartpos);
+            setPosition(pos, FenPosStartpos);
             TT::clear();
             initSearch();
         }
 
 
-        // "isready": respond to GUI that we are ready
+        // "isready": respond to GUI that we are ready (through the output
+        // thread, since the search may be printing at the same time)
         else if (token == "isready")
-            cout << "readyok" << endl << flush;
+            Threads::send("readyok\n");
 
 
         // Additional custom non-UCI commands, mainly for debugging.
-        // Do not use these commands during a search!
 
         // "flip": flip the board when being printed
         else if (token == "flip")
         {
             flip = !flip;
-            printBoard();
+            printBoard(pos);
         }
 
 
@@ -551,39 +1493,71 @@ void UCI::loop(int argc, char* argv[])
             printHelp();
 
 
-        // "moves": print the list of pseudo-legal moves, non-sorted
+        // "moves": print the list of legal moves, non-sorted
         else if (token == "moves")
         {
             MoveList_t MoveList;
-            generateMoves(MoveList);
+            generateMoves(pos, MoveList);
             printMoveList(MoveList);
         }
 
 
-        // "smoves": print the list of pseudo-legal moves, sorted by score
+        // "smoves": print the list of legal moves in the order the search
+        // picks them (see nextMove()), without any TT or PV move
         else if (token == "smoves")
         {
-            MoveList_t MoveList;
-            generateMoves(MoveList);
-            sortMoves(MoveList, 0);
-            printMoveScores(MoveList);
+            MovePicker_t mp;
+            followPV = false;
+            initMovePicker(pos, mp, 0, false);
+
+            cout << "     Move order:" << endl << endl;
+
+            for (int move = nextMove(pos, mp); move; move = nextMove(pos, mp))
+                cout << "     move: " << prettyMove(move) << endl;
+
+            cout << endl << endl;
         }
 
 
-        //else if (token == "bench")    bench(pos, is, states);
+        // "bench": search a fixed set of positions and report the speed
+        else if (token == "bench")
+            UCI::bench(is);
+
+
+        // "analyze": search all the positions of a file (batch analysis)
+        else if (token == "analyze")
+            UCI::analyze(is);
+
+
+        // "gensfen": generate training data from self-play games
+        else if (token == "gensfen")
+            UCI::gensfen(is);
 
 
         // "d": show the current board
         else if (token == "d")
         {
-            printBoard();
+            printBoard(pos);
             cout << flush;
         }
 
 
         // "eval": print the static evaluation for the current position
         else if (token == "eval")
-            traceEval();
+            traceEval(pos);
+
+
+        // "nnuecache": write the weights cache of the network
+        else if (token == "nnuecache")
+        {
+            if (!nnue_write_cache())
+                cout << "info string Cannot write the weights cache" << endl << flush;
+        }
+
+
+        // "stats": print the statistics of the last search
+        else if (token == "stats")
+            Stats::print(false);
 
 
         // "unknown command"
@@ -591,6 +1565,10 @@ void UCI::loop(int argc, char* argv[])
             cout << "Unknown command: " << cmd << endl << flush;
     }
     while ((token != "quit") && (argc == 1)); // Command line args are one-shot
+
+
+    // let the search started from the command line (if any) finish
+    Threads::waitSearch();
 }
 
 
@@ -612,10 +1590,25 @@ void UCI::printHelp()
     cout << "- flip: flip the board when being printed";
     cout << endl;
 
-    cout << "- moves: print the list of pseudo-legal moves, without being sorted";
+    cout << "- moves: print the list of legal moves, without being sorted";
+    cout << endl;
+
+    cout << "- smoves: print the list of legal moves in the order the search picks them";
+    cout << endl;
+
+    cout << "- bench [depth] [hash] [threads]: search a fixed set of positions and print the nodes and speed";
+    cout << endl;
+
+    cout << "- analyze <file|-> [depth N] [hash H] [threads T] [output <file>] [warm]: search every FEN of a file";
+    cout << endl;
+
+    cout << "- gensfen [games G] [depth N] [hash H] [threads T] [random R] [evallimit E] [maxply M] [seed S] [format bin|plain] [output <file>]: generate NNUE training data from self-play games";
+    cout << endl;
+
+    cout << "- nnuecache: cache the network weights in a file that later runs map (shared by all the processes)";
     cout << endl;
 
-    cout << "- smoves: print the list of pseudo-legal moves, sorted by score";
+    cout << "- stats: print the statistics of the last search (build with: make STATS=yes)";
     cout << endl << endl;
 }
 
@@ -626,6 +1619,12 @@ void UCI::printHelp()
 // Set the engine options to the original defaults.
 void UCI::resetOptions()
 {
-    Options["Hash"]     = OptionsDefaultHashSize;
-    Options["Contempt"] = OptionsDefaultContempt;
+    Options["Hash"]          = OptionsDefaultHashSize;
+    Options["Threads"]       = OptionsDefaultThreads;
+    Options["Contempt"]      = OptionsDefaultContempt;
+    Options["PerftHash"]     = OptionsDefaultPerftHash;
+    Options["Move Overhead"] = OptionsDefaultMoveOverhead;
+    Options["Ponder"]        = false;
+    Options["OwnBook"]       = false;
+    Options["MultiPV"]       = OptionsDefaultMultiPV;
 }
@@ -23,6 +23,9 @@
 
 #include <map>
 
+#include "bitboard.h"
+#include "position.h"
+
 
 
 // Engine information 
@@ -33,9 +36,66 @@
 
 
 
-// Default sizes for the Hash option
-#define HashMinSize   16
-#define HashMaxSize 1024
+// Default sizes for the Hash option (in MBytes)
+#define HashMinSize       16
+#define HashMaxSize   131072
+
+
+
+// Maximum size of the PerftHash option (in MBytes), 0 disables it
+#define PerftHashMaxSize   4096
+
+
+
+// Number of search threads allowed in the Threads option
+#define ThreadsMin       1
+#define ThreadsMax     256
+
+
+
+// Default settings of the "bench" command: depth, Hash (MBytes) and Threads
+#define BenchDefaultDepth     8
+#define BenchDefaultHash     16
+#define BenchDefaultThreads   1
+
+
+
+// Default settings of the "analyze" command: depth, Hash (MBytes) and Threads
+#define AnalyzeDefaultDepth  10
+#define AnalyzeDefaultHash   16
+#define AnalyzeDefaultThreads 1
+
+
+
+// Default settings of the "gensfen" command: number of games, depth, Hash
+// (MBytes), Threads, random opening plies, score at which a game is
+// adjudicated, maximum length of a game (plies) and size of the buffer where
+// every thread collects its records before writing them (bytes)
+#define GensfenDefaultGames       100
+#define GensfenDefaultDepth         6
+#define GensfenDefaultHash         16
+#define GensfenDefaultThreads       1
+#define GensfenDefaultRandomPlies   8
+#define GensfenDefaultEvalLimit  3000
+#define GensfenDefaultMaxPly      400
+#define GensfenBufferSize     1048576
+
+
+
+// PackedSfenValue_t is a training record written by the "gensfen" command,
+// in the .bin format of the Stockfish trainers (40 bytes): the position
+// packed in 256 bits, its score and result from the point of view of the side
+// to move (1 win, 0 draw, -1 loss), the move played (Stockfish encoding) and
+// the game ply.
+typedef struct
+{
+    uint8_t  sfen[32];
+    int16_t  score;
+    uint16_t move;
+    uint16_t gamePly;
+    int8_t   result;
+    uint8_t  padding;
+} PackedSfenValue_t;
 
 
 
@@ -44,11 +104,14 @@ namespace UCI
 {
 
 string moveToString(int m);
-int parseMove(string);
+int parseMove(Position_t &, string);
 void position(istringstream &);
 void go(istringstream &);
+void bench(istringstream &);
+void analyze(istringstream &);
+void gensfen(istringstream &);
 void setOption(istringstream &);
-void traceEval();
+void traceEval(Position_t &);
 void loop(int argc, char *argv[]);
 void printHelp();
 void resetOptions();